@@ -0,0 +1,88 @@
+// measures hash64 on the kernel picked for this cpu and hash_tree_file on
+// 1 to all cores, in GB/s and GB/s per core. the tree file is written just
+// before it's hashed, so it's read from the page cache, not the disk
+
+#include "hash.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+constexpr u64 BENCH_BYTES = 512ull * 1024 * 1024;
+constexpr i32 BENCH_RUNS = 3;
+
+static f64 now_seconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<f64>(now).count();
+}
+
+// best of a few runs, the first ones warm up caches and clocks
+template <typename F> static f64 best_seconds(F f) {
+  f64 best = 1e9;
+  for (i32 run = 0; run < BENCH_RUNS; run++) {
+    f64 start = now_seconds();
+    f();
+    best = std::min(best, now_seconds() - start);
+  }
+  return best;
+}
+
+static f64 gbps(u64 bytes, f64 seconds) { return bytes / seconds / 1e9; }
+
+int main(int argc, char **argv) {
+  std::vector<u8> data(BENCH_BYTES);
+  u64 x = 0x9e3779b97f4a7c15;
+  for (u64 i = 0; i < data.size(); i += 8) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    memcpy(&data[i], &x, 8);
+  }
+
+  // printed so the hashing can't be left out
+  u64 hash = 0;
+  f64 seconds = best_seconds([&] { hash = hash64(data.data(), data.size()); });
+  printf("hash64 %s: %.2f GB/s on 1 core (%016llx)\n", hash64_kernel(),
+         gbps(data.size(), seconds), (unsigned long long)hash);
+
+  fs::path path = argc > 1 ? fs::path(argv[1])
+                           : fs::temp_directory_path() / "hash_bench.bin";
+  FILE *fp = fopen(path.string().data(), "wb");
+  if (!fp || fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+    fprintf(stderr, "cannot write %s\n", path.string().data());
+    return 1;
+  }
+  fclose(fp);
+  std::error_code ec;
+  defer(fs::remove(path, ec));
+
+  u32 cores = std::max(std::thread::hardware_concurrency(), 1u);
+  for (u32 threads = 1;; threads = std::min(threads * 2, cores)) {
+    HashPool pool;
+    hash_pool_start(&pool, threads);
+    defer(hash_pool_stop(&pool));
+
+    u8 out[32];
+    bool ok = true;
+    seconds = best_seconds(
+        [&] { ok &= hash_tree_file(&pool, path.string().data(), out); });
+    if (!ok) {
+      fprintf(stderr, "cannot hash %s\n", path.string().data());
+      return 1;
+    }
+
+    f64 rate = gbps(data.size(), seconds);
+    printf("hash_tree_file: %.2f GB/s on %u threads, %.2f GB/s per core\n",
+           rate, threads, rate / threads);
+    if (threads == cores) {
+      break;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+// compares scan_tree with std::filesystem::recursive_directory_iterator on
+// a tree, both collecting the size and mtime of every file.
+//
+//   scan_bench <dir> [--cold] [threads]
+//
+// threads defaults to the number of cores. warm runs read the directories
+// from the page cache, and each result is the best of a few runs. with
+// --cold the caches are dropped before every run (sync, then 3 written to
+// /proc/sys/vm/drop_caches), which needs root and linux, so each run reads
+// the metadata from the disk. cold runs are single runs, their numbers
+// vary with the disk and should be repeated
+
+#include "scan.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+constexpr i32 BENCH_RUNS = 3;
+
+static f64 now_seconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<f64>(now).count();
+}
+
+static bool drop_caches() {
+  sync();
+  FILE *fp = fopen("/proc/sys/vm/drop_caches", "w");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fputs("3", fp) >= 0;
+  return fclose(fp) == 0 && ok;
+}
+
+// files found, or -1 if the tree couldn't be read. bytes is their total
+// size, the two walks should agree on it
+static i64 iterator_walk(const std::string &root, u64 *bytes) {
+  std::error_code ec;
+  auto opts = fs::directory_options::skip_permission_denied;
+  i64 files = 0;
+  *bytes = 0;
+  for (auto &entry : fs::recursive_directory_iterator(root, opts, ec)) {
+    if (entry.is_regular_file(ec) && !entry.is_symlink(ec)) {
+      *bytes += entry.file_size(ec);
+      entry.last_write_time(ec);
+      files++;
+    }
+  }
+  return ec ? -1 : files;
+}
+
+static i64 tree_walk(const std::string &root, u32 threads, u64 *bytes) {
+  ScanTree tree;
+  ScanOptions opts;
+  opts.threads = threads;
+  if (!scan_tree(root, &tree, opts)) {
+    return -1;
+  }
+
+  i64 files = 0;
+  *bytes = 0;
+  for (auto &entry : tree.entries) {
+    if (entry.kind == ScanKind::File) {
+      *bytes += entry.size;
+      files++;
+    }
+  }
+  return files;
+}
+
+template <typename F>
+static bool bench(const char *name, bool cold, F walk) {
+  f64 best = 1e9;
+  i64 files = 0;
+  u64 bytes = 0;
+  for (i32 run = 0; run < (cold ? 1 : BENCH_RUNS); run++) {
+    if (cold && !drop_caches()) {
+      fprintf(stderr, "cannot drop caches, --cold needs root\n");
+      return false;
+    }
+
+    f64 start = now_seconds();
+    files = walk(&bytes);
+    best = std::min(best, now_seconds() - start);
+    if (files < 0) {
+      fprintf(stderr, "cannot read the tree\n");
+      return false;
+    }
+  }
+
+  printf("%-28s %8.3fs %10lld files %14llu bytes %10.0f files/s\n", name,
+         best, (long long)files, (unsigned long long)bytes, files / best);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: scan_bench <dir> [--cold] [threads]\n");
+    return 1;
+  }
+  std::string root = argv[1];
+  bool cold = false;
+  u32 cores = std::max(std::thread::hardware_concurrency(), 1u);
+  for (i32 i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--cold") == 0) {
+      cold = true;
+    } else {
+      cores = (u32)std::max(atoi(argv[i]), 1);
+    }
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "scan_tree, %u threads", cores);
+
+  bool ok = bench("recursive_directory_iterator", cold,
+                  [&](u64 *bytes) { return iterator_walk(root, bytes); });
+  ok = ok && bench("scan_tree, 1 thread", cold,
+                   [&](u64 *bytes) { return tree_walk(root, 1, bytes); });
+  ok = ok && (cores == 1 || bench(name, cold, [&](u64 *bytes) {
+                return tree_walk(root, cores, bytes);
+              }));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+// compares the streaming upload reader with reading the whole file first,
+// as uploads did before. both hand the file to a sink in sftp write sized
+// pieces, the way the upload loop passes it to libssh2, so the numbers are
+// the local side of an upload without the network:
+//
+//   time to first byte: from opening the file to the first piece sent
+//   total: until the last piece is sent
+//   peak rss: of a child process that only ran that one mode
+//
+//   upload_bench [size in MiB] [--cold]
+//
+// the file is written first and is 1024 MiB by default. with --cold the
+// page cache is dropped before each mode (sync, then 3 written to
+// /proc/sys/vm/drop_caches), which needs root, so the file is read from
+// the disk. otherwise it's read from the page cache
+
+#include "reader.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// the same sizes as the upload path in main.cpp
+constexpr u64 SFTP_WRITE_SIZE = 32 * 1024;
+constexpr u64 UPLOAD_CHUNK_SIZE = 1024 * 1024;
+
+static f64 now_seconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<f64>(now).count();
+}
+
+static bool drop_caches() {
+  sync();
+  FILE *fp = fopen("/proc/sys/vm/drop_caches", "w");
+  if (!fp) {
+    return false;
+  }
+  bool ok = fputs("3", fp) >= 0;
+  return fclose(fp) == 0 && ok;
+}
+
+struct Sink {
+  f64 start = 0;
+  f64 first = 0; // when the first piece came in
+  u64 bytes = 0;
+  u64 check = 0; // touches the data, so reading it can't be left out
+};
+
+static void sink_send(Sink *sink, const char *data, u64 len) {
+  if (sink->bytes == 0) {
+    sink->first = now_seconds();
+  }
+  for (u64 i = 0; i < len; i += 4096) {
+    sink->check += (u8)data[i];
+  }
+  sink->bytes += len;
+}
+
+// what uploads did before: an ifstream copied into an ostringstream, then
+// copied out again, then written
+static bool send_whole(const char *path, Sink *sink) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (ifs.fail()) {
+    return false;
+  }
+  std::ostringstream oss;
+  oss << ifs.rdbuf();
+  std::string contents = oss.str();
+
+  for (u64 pos = 0; pos < contents.size(); pos += SFTP_WRITE_SIZE) {
+    u64 len = std::min<u64>(SFTP_WRITE_SIZE, contents.size() - pos);
+    sink_send(sink, contents.data() + pos, len);
+  }
+  return true;
+}
+
+static bool send_stream(const char *path, Sink *sink) {
+  ReadThread reads;
+  read_thread_start(&reads, nullptr, nullptr);
+  defer(read_thread_stop(&reads));
+
+  ChunkReader reader;
+  if (!reader_open(&reader, &reads, path, UPLOAD_CHUNK_SIZE)) {
+    return false;
+  }
+  defer(reader_close(&reader));
+
+  while (true) {
+    const char *data = nullptr;
+    u64 len = reader_peek(&reader, &data, SFTP_WRITE_SIZE);
+    if (len == 0) {
+      if (reader.eof) {
+        break;
+      }
+      // the io loop would run other uploads here
+      std::this_thread::yield();
+      continue;
+    }
+    sink_send(sink, data, len);
+    reader.pos += len;
+  }
+  return !reader.failed;
+}
+
+// runs one mode in a child, so its peak rss is its own
+static bool run(const char *name, const char *path, u64 size, bool cold,
+                bool (*send)(const char *, Sink *)) {
+  if (cold && !drop_caches()) {
+    fprintf(stderr, "cannot drop caches, --cold needs root\n");
+    return false;
+  }
+
+  i32 fds[2];
+  if (pipe(fds)) {
+    return false;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    Sink sink;
+    sink.start = now_seconds();
+    bool ok = send(path, &sink) && sink.bytes == size;
+    f64 times[2] = {sink.first - sink.start, now_seconds() - sink.start};
+    ok = ok && write(fds[1], times, sizeof(times)) == sizeof(times);
+    _exit(ok ? 0 : 1);
+  }
+  close(fds[1]);
+
+  f64 times[2] = {};
+  bool got = read(fds[0], times, sizeof(times)) == sizeof(times);
+  close(fds[0]);
+
+  i32 status = 0;
+  rusage usage = {};
+  if (pid < 0 || wait4(pid, &status, 0, &usage) != pid || status != 0 ||
+      !got) {
+    fprintf(stderr, "%s: failed\n", name);
+    return false;
+  }
+
+  printf("%-7s first byte %9.2f ms, total %7.3f s, %8.1f MB/s, "
+         "peak rss %8.1f MiB\n",
+         name, times[0] * 1000, times[1], size / times[1] / 1e6,
+         usage.ru_maxrss / 1024.0);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  u64 mib = 1024;
+  bool cold = false;
+  for (i32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cold") == 0) {
+      cold = true;
+    } else {
+      mib = std::max(strtoull(argv[i], nullptr, 10), 1ull);
+    }
+  }
+
+  fs::path path = fs::temp_directory_path() / "upload_bench.bin";
+  FILE *fp = fopen(path.string().data(), "wb");
+  if (!fp) {
+    fprintf(stderr, "cannot write %s\n", path.string().data());
+    return 1;
+  }
+  std::vector<char> block(1024 * 1024);
+  for (u64 i = 0; i < block.size(); i++) {
+    block[i] = (char)(i * 2654435761u >> 24);
+  }
+  bool written = true;
+  for (u64 i = 0; i < mib; i++) {
+    written &= fwrite(block.data(), 1, block.size(), fp) == block.size();
+  }
+  written &= fclose(fp) == 0;
+  std::error_code ec;
+  defer(fs::remove(path, ec));
+  if (!written) {
+    fprintf(stderr, "cannot write %s\n", path.string().data());
+    return 1;
+  }
+
+  u64 size = mib * 1024 * 1024;
+  printf("%llu MiB file, %s cache\n", (unsigned long long)mib,
+         cold ? "cold" : "warm");
+  bool ok = run("whole", path.string().data(), size, cold, send_whole);
+  ok = ok && run("stream", path.string().data(), size, cold, send_stream);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// time from a file being written to the watcher reporting it, the part of
+// edit to upload start that the watcher thread changed. edits are made at
+// random times and read back two ways:
+//
+//   frame: polled once per frame, with the frame loop idle in
+//          glfwWaitEventsTimeout(0.25), as before the watcher thread
+//   thread: a thread blocked in watcher_wait, as now
+//
+// the app holds every change back for its quiet period (quiet_ms) on top
+// of this, so a path written many times in a row is uploaded once
+
+#include "watch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <thread>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+constexpr i32 BENCH_EDITS = 40;
+constexpr i32 FRAME_MS = 250;
+
+static f64 now_seconds() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration<f64>(now).count();
+}
+
+struct Edits {
+  std::mutex mtx;
+  std::unordered_map<std::string, f64> written; // name -> when
+  std::vector<f64> latencies;
+};
+
+static void take_changes(FileWatcher *watcher, Edits *edits) {
+  f64 now = now_seconds();
+  std::lock_guard lock(edits->mtx);
+  for (auto &change : watcher->changes) {
+    auto it = edits->written.find(change.filename);
+    if (change.type == FileAction::Modified && it != edits->written.end()) {
+      edits->latencies.push_back(now - it->second);
+      edits->written.erase(it);
+    }
+  }
+}
+
+static bool run(const char *name, const fs::path &base, bool frame) {
+  fs::path root = base / name;
+  fs::create_directories(root);
+
+  FileWatcher watcher;
+  const wchar_t *error = nullptr;
+  if (!watcher_init(&watcher, root, &error)) {
+    fprintf(stderr, "%ls\n", error);
+    return false;
+  }
+  defer(watcher_destroy(&watcher));
+
+  Edits edits;
+  std::atomic<bool> done = false;
+  std::thread reader([&] {
+    while (!done) {
+      if (frame) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_MS));
+      } else {
+        watcher_wait(&watcher, -1);
+      }
+      watcher_poll(&watcher);
+      take_changes(&watcher, &edits);
+    }
+  });
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<i32> gap(0, 2 * FRAME_MS);
+  for (i32 i = 0; i < BENCH_EDITS; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(gap(rng)));
+    std::string file = "edit" + std::to_string(i);
+    FILE *fp = fopen((root / file).string().data(), "wb");
+    fputs("x", fp);
+    {
+      std::lock_guard lock(edits.mtx);
+      edits.written[file] = now_seconds();
+    }
+    fclose(fp);
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(2 * FRAME_MS));
+  done = true;
+  watcher_wake(&watcher);
+  reader.join();
+
+  auto &l = edits.latencies;
+  if (l.empty()) {
+    fprintf(stderr, "%s: no edits were reported\n", name);
+    return false;
+  }
+  std::sort(l.begin(), l.end());
+  f64 total = 0;
+  for (f64 x : l) {
+    total += x;
+  }
+  printf("%-6s %3zu edits: %7.2f ms avg, %7.2f ms p50, %7.2f ms max\n", name,
+         l.size(), total / l.size() * 1000, l[l.size() / 2] * 1000,
+         l.back() * 1000);
+  return true;
+}
+
+int main() {
+  fs::path root = fs::temp_directory_path() / "watch_latency";
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  fs::create_directories(root);
+  defer(fs::remove_all(root, ec));
+
+  bool ok = run("frame", root, true);
+  ok = ok && run("thread", root, false);
+  return ok ? 0 : 1;
+}
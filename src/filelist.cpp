@@ -0,0 +1,83 @@
+#include "filelist.h"
+#include <algorithm>
+
+void file_list_clear(FileList *list) {
+  list->names.clear();
+  list->starts.clear();
+  list->sizes.clear();
+  list->mtimes.clear();
+  list->kinds.clear();
+  list->order.clear();
+}
+
+void file_list_reserve(FileList *list, u64 entries, u64 name_bytes) {
+  list->names.reserve(name_bytes + entries);
+  list->starts.reserve(entries);
+  list->sizes.reserve(entries);
+  list->mtimes.reserve(entries);
+  list->kinds.reserve(entries);
+  list->order.reserve(entries);
+}
+
+void file_list_add(FileList *list, std::string_view name, FileKind kind,
+                   u64 size, u32 mtime) {
+  list->order.push_back(file_list_size(*list));
+  list->starts.push_back((u32)list->names.size());
+  list->names.append(name);
+  list->names.push_back(0);
+  list->sizes.push_back(size);
+  list->mtimes.push_back(mtime);
+  list->kinds.push_back(kind);
+}
+
+void file_list_append(FileList *list, const FileList &from) {
+  u32 base = file_list_size(*list);
+  u32 name_base = (u32)list->names.size();
+  list->names.append(from.names);
+  for (u32 start : from.starts) {
+    list->starts.push_back(name_base + start);
+  }
+  list->sizes.insert(list->sizes.end(), from.sizes.begin(), from.sizes.end());
+  list->mtimes.insert(list->mtimes.end(), from.mtimes.begin(),
+                      from.mtimes.end());
+  list->kinds.insert(list->kinds.end(), from.kinds.begin(), from.kinds.end());
+  for (u32 entry : from.order) {
+    list->order.push_back(base + entry);
+  }
+}
+
+void file_list_sort(FileList *list, u32 from) {
+  auto by_name = [&](u32 a, u32 b) {
+    return file_list_name(*list, a) < file_list_name(*list, b);
+  };
+
+  auto mid = list->order.begin() + from;
+  std::sort(mid, list->order.end(), by_name);
+  std::inplace_merge(list->order.begin(), mid, list->order.end(), by_name);
+}
+
+i32 file_list_find(const FileList &list, std::string_view name) {
+  auto it = std::lower_bound(
+      list.order.begin(), list.order.end(), name,
+      [&](u32 entry, std::string_view name) {
+        return file_list_name(list, entry) < name;
+      });
+  if (it == list.order.end() || file_list_name(list, *it) != name) {
+    return -1;
+  }
+  return (i32)*it;
+}
+
+void file_list_put(FileList *list, std::string_view name, FileKind kind,
+                   u64 size, u32 mtime) {
+  i32 entry = file_list_find(*list, name);
+  if (entry < 0) {
+    file_list_add(list, name, kind, size, mtime);
+    file_list_sort(list, file_list_size(*list) - 1);
+    return;
+  }
+
+  list->kinds[entry] = kind;
+  list->sizes[entry] = size;
+  list->mtimes[entry] = mtime;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "language.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class FileKind : u8 {
+  None,
+  File,
+  Dir,
+};
+
+// the entries of a directory listing in parallel arrays, with every name
+// in one pool. a panel scans names, so they're kept apart from the rest,
+// and sorting moves the 4 byte row indices instead of the entries
+struct FileList {
+  std::string names;       // each followed by a 0, so they're c strings
+  std::vector<u32> starts; // offset of every entry's name
+  std::vector<u64> sizes;
+  std::vector<u32> mtimes; // unix seconds, 0 if unknown
+  std::vector<FileKind> kinds;
+  std::vector<u32> order; // entry index of every row
+};
+
+void file_list_clear(FileList *list);
+void file_list_reserve(FileList *list, u64 entries, u64 name_bytes);
+
+// the entry is added as the last row
+void file_list_add(FileList *list, std::string_view name, FileKind kind,
+                   u64 size, u32 mtime);
+
+// adds the entries of from after the ones already in the list
+void file_list_append(FileList *list, const FileList &from);
+
+// sorts the rows from the given one on by name and merges them into the
+// rows before, which have to be sorted already
+void file_list_sort(FileList *list, u32 from);
+
+// the entry with the name, or -1. the rows have to be sorted
+i32 file_list_find(const FileList &list, std::string_view name);
+
+// updates the entry with the name, or adds it in its sorted row
+void file_list_put(FileList *list, std::string_view name, FileKind kind,
+                   u64 size, u32 mtime);
+
+inline u32 file_list_size(const FileList &list) {
+  return (u32)list.kinds.size();
+}
+
+inline std::string_view file_list_name(const FileList &list, u32 entry) {
+  u32 begin = list.starts[entry];
+  u32 end = entry + 1 < list.starts.size() ? list.starts[entry + 1]
+                                           : (u32)list.names.size();
+  return std::string_view(list.names.data() + begin, end - begin - 1);
+}
@@ -0,0 +1,417 @@
+#include "finder.h"
+#include <algorithm>
+#include <thread>
+
+// paths a ranking worker scores between looks at the cancel flag
+constexpr u32 FINDER_CANCEL_CHECK = 4096;
+
+static char fold(char c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; }
+
+static u32 trigram_class(char c) {
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 1;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 27;
+  }
+  switch (c) {
+  case '.': return 37;
+  case '_': return 38;
+  case '-': return 39;
+  case '/': return 40;
+  case ' ': return 41;
+  default: return 42 + (u8)c % 22;
+  }
+}
+
+template <typename F> static void each_trigram(std::string_view s, F f) {
+  if (s.size() < 3) {
+    return;
+  }
+
+  u32 key = (trigram_class(s[0]) << 6) | trigram_class(s[1]);
+  for (u64 i = 2; i < s.size(); i++) {
+    key = ((key << 6) | trigram_class(s[i])) & (FINDER_KEYS - 1);
+    f(key);
+  }
+}
+
+static std::string_view finder_path(const FinderIndex &index, u32 id) {
+  u32 begin = index.starts[id];
+  return std::string_view(index.text.data() + begin,
+                          index.starts[id + 1] - 1 - begin);
+}
+
+void finder_index_build(FinderIndex *index,
+                        const std::vector<std::string> &paths) {
+  index->text.clear();
+  index->starts.clear();
+  index->starts.reserve(paths.size() + 1);
+  for (auto &path : paths) {
+    index->starts.push_back((u32)index->text.size());
+    for (char c : path) {
+      index->text.push_back(fold(c));
+    }
+    index->text.push_back(0);
+  }
+  index->starts.push_back((u32)index->text.size());
+
+  // counted first, then filled in, so every key's ids are one slice of a
+  // single array. last keeps a path from being listed twice under a key
+  u32 count = finder_index_paths(*index);
+  std::vector<u32> last(FINDER_KEYS, 0);
+  index->offsets.assign(FINDER_KEYS + 1, 0);
+  for (u32 id = 0; id < count; id++) {
+    each_trigram(finder_path(*index, id), [&](u32 key) {
+      if (last[key] != id + 1) {
+        last[key] = id + 1;
+        index->offsets[key + 1]++;
+      }
+    });
+  }
+  for (u32 key = 0; key < FINDER_KEYS; key++) {
+    index->offsets[key + 1] += index->offsets[key];
+  }
+
+  std::vector<u32> next(index->offsets.begin(), index->offsets.end() - 1);
+  std::fill(last.begin(), last.end(), 0);
+  index->ids.resize(index->offsets.back());
+  for (u32 id = 0; id < count; id++) {
+    each_trigram(finder_path(*index, id), [&](u32 key) {
+      if (last[key] != id + 1) {
+        last[key] = id + 1;
+        index->ids[next[key]++] = id;
+      }
+    });
+  }
+}
+
+static bool is_boundary(std::string_view path, u64 i) {
+  if (i == 0) {
+    return true;
+  }
+  char c = path[i - 1];
+  return c == '/' || c == '.' || c == '_' || c == '-' || c == ' ';
+}
+
+static bool has_chars(std::string_view path, std::string_view term) {
+  u64 pos = 0;
+  for (char c : term) {
+    pos = path.find(c, pos);
+    if (pos == std::string_view::npos) {
+      return false;
+    }
+    pos++;
+  }
+  return true;
+}
+
+// higher is better. whole matches beat scattered ones, and matches in the
+// file name beat ones in directories
+static i32 score_term(std::string_view path, u64 base, std::string_view term) {
+  i32 len = (i32)term.size();
+
+  u64 at = path.find(term, base);
+  if (at != std::string_view::npos) {
+    i32 score = 16 * len + 32;
+    if (is_boundary(path, at)) {
+      score += 16;
+    }
+    if (at == base && term.size() == path.size() - base) {
+      score += 32;
+    }
+    return score;
+  }
+
+  at = path.find(term);
+  if (at != std::string_view::npos) {
+    return 16 * len + (is_boundary(path, at) ? 16 : 0);
+  }
+
+  i32 score = 0;
+  u64 pos = 0;
+  u64 prev = std::string_view::npos;
+  for (char c : term) {
+    u64 i = path.find(c, pos);
+    score += 4;
+    if (is_boundary(path, i)) {
+      score += 6;
+    }
+    if (prev != std::string_view::npos && i == prev + 1) {
+      score += 4;
+    }
+    prev = i;
+    pos = i + 1;
+  }
+  return score;
+}
+
+// -1 if a term isn't in the path
+static i32 score_path(std::string_view path,
+                      const std::vector<std::string_view> &terms) {
+  // most paths don't match at all, this rejects them in one pass per term
+  for (auto term : terms) {
+    if (!has_chars(path, term)) {
+      return -1;
+    }
+  }
+
+  u64 slash = path.rfind('/');
+  u64 base = slash == std::string_view::npos ? 0 : slash + 1;
+
+  i32 total = 0;
+  for (auto term : terms) {
+    total += score_term(path, base, term);
+  }
+
+  // the shorter of two paths that match alike is the likelier one
+  return total - (i32)(path.size() / 4);
+}
+
+static bool hit_better(const FinderHit &a, const FinderHit &b) {
+  return a.score != b.score ? a.score > b.score : a.id < b.id;
+}
+
+struct FinderRank {
+  const FinderIndex *index;
+  const std::vector<std::string_view> *terms;
+  const u32 *ids; // candidates, or every path if null
+  u32 count;
+  u32 limit;
+  const std::atomic<bool> *cancel;
+};
+
+struct FinderSlice {
+  std::vector<FinderHit> hits;
+  std::vector<u32> matches;
+};
+
+// keeps the best limit hits of one slice of the candidates in a heap with
+// the worst hit on top, and lists every candidate that matched
+static void rank_slice(const FinderRank *rank, u32 begin, u32 end,
+                       FinderSlice *slice) {
+  std::vector<FinderHit> *out = &slice->hits;
+  for (u32 i = begin; i < end; i++) {
+    if ((i - begin) % FINDER_CANCEL_CHECK == 0 && rank->cancel &&
+        *rank->cancel) {
+      return;
+    }
+
+    u32 id = rank->ids ? rank->ids[i] : i;
+    i32 score = score_path(finder_path(*rank->index, id), *rank->terms);
+    if (score < 0) {
+      continue;
+    }
+    slice->matches.push_back(id);
+
+    FinderHit hit = {id, score};
+    if (out->size() < rank->limit) {
+      out->push_back(hit);
+      std::push_heap(out->begin(), out->end(), hit_better);
+    } else if (hit_better(hit, out->front())) {
+      std::pop_heap(out->begin(), out->end(), hit_better);
+      out->back() = hit;
+      std::push_heap(out->begin(), out->end(), hit_better);
+    }
+  }
+}
+
+// one ranking split over the pool, a slice per thread taking part
+struct FinderRun {
+  const FinderRank *rank;
+  std::vector<FinderSlice> slices;
+};
+
+static void rank_run_slice(FinderRun *run, u32 i) {
+  u64 count = run->rank->count;
+  u64 n = run->slices.size();
+  rank_slice(run->rank, (u32)(count * i / n), (u32)(count * (i + 1) / n),
+             &run->slices[i]);
+}
+
+// worker i ranks slice i of every run that has one
+static void finder_pool_worker(FinderPool *pool, u32 slice) {
+  u64 seen = 0;
+  std::unique_lock lock(pool->mtx);
+  while (true) {
+    pool->cv.wait(lock, [&]() { return pool->quit || pool->job != seen; });
+    if (pool->quit) {
+      return;
+    }
+    seen = pool->job;
+    if (slice >= pool->slices) {
+      continue;
+    }
+
+    FinderRun *run = pool->run;
+    lock.unlock();
+    rank_run_slice(run, slice);
+    lock.lock();
+
+    if (--pool->busy == 0) {
+      pool->done_cv.notify_one();
+    }
+  }
+}
+
+void finder_pool_start(FinderPool *pool, u32 threads) {
+  pool->quit = false;
+  for (u32 i = 1; i < threads; i++) {
+    pool->threads.emplace_back(finder_pool_worker, pool, i);
+  }
+}
+
+void finder_pool_stop(FinderPool *pool) {
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->quit = true;
+  }
+  pool->cv.notify_all();
+  for (auto &thread : pool->threads) {
+    thread.join();
+  }
+  pool->threads.clear();
+}
+
+// a few candidates are ranked on the searching thread alone, waking the
+// workers would take longer
+static void rank_hits(const FinderRank &rank, FinderPool *pool,
+                      std::vector<FinderHit> *hits, std::vector<u32> *matches) {
+  u32 threads = std::clamp((u32)pool->threads.size() + 1, 1u,
+                           std::max(rank.count / 1024, 1u));
+
+  FinderRun run = {&rank, std::vector<FinderSlice>(threads)};
+  if (threads > 1) {
+    {
+      std::lock_guard lock(pool->mtx);
+      pool->run = &run;
+      pool->slices = threads;
+      pool->busy = threads - 1;
+      pool->job++;
+    }
+    pool->cv.notify_all();
+  }
+
+  rank_run_slice(&run, 0);
+
+  if (threads > 1) {
+    std::unique_lock lock(pool->mtx);
+    pool->done_cv.wait(lock, [&]() { return pool->busy == 0; });
+  }
+
+  // slices are in order, so the matches stay sorted
+  hits->clear();
+  matches->clear();
+  for (auto &slice : run.slices) {
+    hits->insert(hits->end(), slice.hits.begin(), slice.hits.end());
+    matches->insert(matches->end(), slice.matches.begin(),
+                    slice.matches.end());
+  }
+  std::sort(hits->begin(), hits->end(), hit_better);
+  if (hits->size() > rank.limit) {
+    hits->resize(rank.limit);
+  }
+}
+
+// paths listed under every key. each list is searched from where the last
+// candidate was found, starting from the shortest
+static void intersect(const FinderIndex &index, const std::vector<u32> &keys,
+                      std::vector<u32> *out) {
+  struct Span {
+    const u32 *begin;
+    const u32 *end;
+  };
+
+  std::vector<Span> spans;
+  for (u32 key : keys) {
+    const u32 *ids = index.ids.data();
+    spans.push_back({ids + index.offsets[key], ids + index.offsets[key + 1]});
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) {
+    return a.end - a.begin < b.end - b.begin;
+  });
+
+  out->clear();
+  for (const u32 *it = spans[0].begin; it != spans[0].end; it++) {
+    bool all = true;
+    for (u64 i = 1; i < spans.size() && all; i++) {
+      spans[i].begin = std::lower_bound(spans[i].begin, spans[i].end, *it);
+      all = spans[i].begin != spans[i].end && *spans[i].begin == *it;
+    }
+    if (all) {
+      out->push_back(*it);
+    }
+  }
+}
+
+bool finder_search(const FinderIndex &index, FinderCache *cache,
+                   std::string_view query, u32 limit, FinderPool *pool,
+                   const std::atomic<bool> *cancel,
+                   std::vector<FinderHit> *hits) {
+  hits->clear();
+
+  std::string folded;
+  for (char c : query) {
+    folded.push_back(fold(c));
+  }
+
+  std::vector<std::string_view> terms;
+  std::vector<u32> keys;
+  std::string_view rest = folded;
+  while (!rest.empty()) {
+    u64 space = rest.find(' ');
+    std::string_view term = rest.substr(0, space);
+    rest = space == std::string_view::npos ? "" : rest.substr(space + 1);
+    if (!term.empty()) {
+      terms.push_back(term);
+      each_trigram(term, [&](u32 key) { keys.push_back(key); });
+    }
+  }
+  if (terms.empty() || limit == 0) {
+    cache->query.clear();
+    cache->complete = false;
+    return true;
+  }
+
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  FinderRank rank = {&index, &terms, nullptr, finder_index_paths(index),
+                     limit, cancel};
+  std::vector<u32> matches;
+  if (!keys.empty()) {
+    std::vector<u32> candidates;
+    intersect(index, keys, &candidates);
+
+    FinderRank whole = rank;
+    whole.ids = candidates.data();
+    whole.count = (u32)candidates.size();
+    rank_hits(whole, pool, hits, &matches);
+    if (cancel && *cancel) {
+      return false;
+    }
+    if (hits->size() >= limit) {
+      // the scattered matches weren't looked for
+      cache->query = folded;
+      cache->complete = false;
+      return true;
+    }
+  }
+
+  // a term can only match where it matched before it was typed further
+  bool narrow = cache->complete && !cache->query.empty() &&
+                folded.starts_with(cache->query);
+  if (narrow) {
+    rank.ids = cache->matches.data();
+    rank.count = (u32)cache->matches.size();
+  }
+  rank_hits(rank, pool, hits, &matches);
+  if (cancel && *cancel) {
+    return false;
+  }
+
+  cache->query = folded;
+  cache->matches.swap(matches);
+  cache->complete = true;
+  return true;
+}
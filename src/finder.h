@@ -0,0 +1,75 @@
+#pragma once
+
+#include "language.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// trigrams are keyed by three 6 bit character classes, so the posting
+// table is dense and small. classes shared by several characters only add
+// candidates, they're all scored against the real path
+constexpr u32 FINDER_KEYS = 1 << 18;
+
+// paths folded to lower case, with the ids of the paths containing each
+// trigram. ids are indices into the list the index was built from
+struct FinderIndex {
+  std::string text;         // paths, each followed by a 0
+  std::vector<u32> starts;  // offset of every path and one past the last
+  std::vector<u32> offsets; // start of every key's ids, and the end
+  std::vector<u32> ids;     // ascending for each key
+};
+
+struct FinderHit {
+  u32 id = 0;
+  i32 score = 0;
+};
+
+void finder_index_build(FinderIndex *index,
+                        const std::vector<std::string> &paths);
+
+inline u32 finder_index_paths(const FinderIndex &index) {
+  return index.starts.empty() ? 0 : (u32)index.starts.size() - 1;
+}
+
+// every path the last query matched, so the next query only scans those
+// when it's the last one typed further
+struct FinderCache {
+  std::string query; // folded
+  std::vector<u32> matches;
+  bool complete = false; // matches holds all of them
+};
+
+struct FinderRun;
+
+// workers that rank slices of the paths along with the thread searching.
+// they stay up between queries, so a keystroke doesn't start threads. a
+// pool answers one query at a time
+struct FinderPool {
+  std::vector<std::thread> threads;
+  std::mutex mtx;
+  std::condition_variable cv;      // wakes the workers
+  std::condition_variable done_cv; // a worker finished its slice
+  FinderRun *run = nullptr;
+  u64 job = 0;    // bumped for every ranking
+  u32 slices = 0; // threads taking part in the run
+  u32 busy = 0;
+  bool quit = false;
+};
+
+// threads counts the searching thread, so 1 starts no workers
+void finder_pool_start(FinderPool *pool, u32 threads);
+void finder_pool_stop(FinderPool *pool);
+
+// the best limit paths for a query of space separated terms, best first.
+// every term has to appear in the path, whole or with gaps between its
+// characters. paths with the terms whole are found through the trigrams,
+// the rest of the paths are only scanned if those are too few.
+// returns false if cancel was set before it finished
+bool finder_search(const FinderIndex &index, FinderCache *cache,
+                   std::string_view query, u32 limit, FinderPool *pool,
+                   const std::atomic<bool> *cancel,
+                   std::vector<FinderHit> *hits);
@@ -0,0 +1,606 @@
+#include "hash.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HASH_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define HASH_AVX2
+#else
+#define HASH_AVX2 __attribute__((target("avx2")))
+#endif
+
+constexpr u64 PRIME32_1 = 0x9e3779b1;
+constexpr u64 PRIME64_1 = 0x9e3779b185ebca87;
+
+constexpr u64 SECRET_SIZE = 192;
+constexpr u64 BLOCK_STRIPES = (SECRET_SIZE - 64) / 8;
+
+static u64 read_u64(const u8 *p) {
+  u64 n;
+  memcpy(&n, p, sizeof(n));
+  return n;
+}
+
+// key material mixed into every stripe. generated once with splitmix64
+static const u8 *hash_secret() {
+  static const auto secret = []() {
+    std::array<u8, SECRET_SIZE> bytes = {};
+    u64 state = 0x243f6a8885a308d3;
+    for (u64 i = 0; i < SECRET_SIZE; i += 8) {
+      u64 z = (state += 0x9e3779b97f4a7c15);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      z ^= z >> 31;
+      memcpy(&bytes[i], &z, sizeof(z));
+    }
+    return bytes;
+  }();
+  return secret.data();
+}
+
+// the simd kernels compute exactly this. used on cpus other than x86-64,
+// and by tests on any cpu
+static void accumulate_scalar(u64 *acc, const u8 *data,
+                                               const u8 *secret, u64 stripes) {
+  for (u64 s = 0; s < stripes; s++) {
+    const u8 *in = data + s * 64;
+    const u8 *key = secret + s * 8;
+    for (i32 i = 0; i < 8; i++) {
+      u64 d = read_u64(in + i * 8);
+      u64 dk = d ^ read_u64(key + i * 8);
+      acc[i ^ 1] += d;
+      acc[i] += (dk & 0xffffffff) * (dk >> 32);
+    }
+  }
+}
+
+static void scramble_scalar(u64 *acc, const u8 *secret) {
+  for (i32 i = 0; i < 8; i++) {
+    u64 a = acc[i];
+    a ^= a >> 47;
+    a ^= read_u64(secret + i * 8);
+    acc[i] = a * PRIME32_1;
+  }
+}
+
+#ifdef HASH_X64
+static void accumulate_sse2(u64 *acc, const u8 *data, const u8 *secret,
+                            u64 stripes) {
+  auto xacc = (__m128i *)acc;
+  for (u64 s = 0; s < stripes; s++) {
+    const u8 *in = data + s * 64;
+    const u8 *key = secret + s * 8;
+    for (i32 i = 0; i < 4; i++) {
+      __m128i d = _mm_loadu_si128((const __m128i *)in + i);
+      __m128i k = _mm_loadu_si128((const __m128i *)key + i);
+      __m128i dk = _mm_xor_si128(d, k);
+      __m128i product = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+      __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+      xacc[i] = _mm_add_epi64(xacc[i], _mm_add_epi64(product, swapped));
+    }
+  }
+}
+
+static void scramble_sse2(u64 *acc, const u8 *secret) {
+  auto xacc = (__m128i *)acc;
+  __m128i prime = _mm_set1_epi32((i32)PRIME32_1);
+  for (i32 i = 0; i < 4; i++) {
+    __m128i a = xacc[i];
+    a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)secret + i));
+    __m128i lo = _mm_mul_epu32(a, prime);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    xacc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+  }
+}
+
+HASH_AVX2 static void accumulate_avx2(u64 *acc, const u8 *data,
+                                      const u8 *secret, u64 stripes) {
+  __m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+  __m256i a1 = _mm256_loadu_si256((const __m256i *)acc + 1);
+  for (u64 s = 0; s < stripes; s++) {
+    const u8 *in = data + s * 64;
+    const u8 *key = secret + s * 8;
+
+    __m256i d0 = _mm256_loadu_si256((const __m256i *)in);
+    __m256i d1 = _mm256_loadu_si256((const __m256i *)in + 1);
+    __m256i dk0 =
+        _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i *)key));
+    __m256i dk1 =
+        _mm256_xor_si256(d1, _mm256_loadu_si256((const __m256i *)key + 1));
+    __m256i p0 = _mm256_mul_epu32(dk0, _mm256_srli_epi64(dk0, 32));
+    __m256i p1 = _mm256_mul_epu32(dk1, _mm256_srli_epi64(dk1, 32));
+    __m256i s0 = _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2));
+    __m256i s1 = _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2));
+    a0 = _mm256_add_epi64(a0, _mm256_add_epi64(p0, s0));
+    a1 = _mm256_add_epi64(a1, _mm256_add_epi64(p1, s1));
+  }
+  _mm256_storeu_si256((__m256i *)acc, a0);
+  _mm256_storeu_si256((__m256i *)acc + 1, a1);
+}
+
+HASH_AVX2 static void scramble_avx2(u64 *acc, const u8 *secret) {
+  __m256i prime = _mm256_set1_epi32((i32)PRIME32_1);
+  for (i32 i = 0; i < 2; i++) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)acc + i);
+    a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+    a = _mm256_xor_si256(a,
+                         _mm256_loadu_si256((const __m256i *)secret + i));
+    __m256i lo = _mm256_mul_epu32(a, prime);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    _mm256_storeu_si256((__m256i *)acc + i,
+                        _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+  }
+}
+
+bool cpu_has_avx2() {
+#ifdef _MSC_VER
+  i32 info[4] = {};
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+
+  // the os has to save the ymm registers too
+  __cpuid(info, 1);
+  bool osxsave = info[2] & (1 << 27);
+  if (!osxsave || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+
+  __cpuidex(info, 7, 0);
+  return info[1] & (1 << 5);
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+struct HashKernel {
+  const char *name;
+  void (*accumulate)(u64 *acc, const u8 *data, const u8 *secret,
+                     u64 stripes);
+  void (*scramble)(u64 *acc, const u8 *secret);
+};
+
+static HashKernel &hash_kernel() {
+  static HashKernel kernel = []() -> HashKernel {
+#ifdef HASH_X64
+    if (cpu_has_avx2()) {
+      return {"avx2", accumulate_avx2, scramble_avx2};
+    }
+    // sse2 is part of x86-64
+    return {"sse2", accumulate_sse2, scramble_sse2};
+#else
+    return {"scalar", accumulate_scalar, scramble_scalar};
+#endif
+  }();
+  return kernel;
+}
+
+const char *hash64_kernel() { return hash_kernel().name; }
+
+bool hash64_use_kernel(const char *name) {
+  HashKernel kernel = {"scalar", accumulate_scalar, scramble_scalar};
+#ifdef HASH_X64
+  if (strcmp(name, "avx2") == 0 && cpu_has_avx2()) {
+    kernel = {"avx2", accumulate_avx2, scramble_avx2};
+  } else if (strcmp(name, "sse2") == 0) {
+    kernel = {"sse2", accumulate_sse2, scramble_sse2};
+  }
+#endif
+  if (strcmp(kernel.name, name) != 0) {
+    return false;
+  }
+  hash_kernel() = kernel;
+  return true;
+}
+
+static u64 mul128_fold64(u64 a, u64 b) {
+#if defined(_MSC_VER) && defined(HASH_X64)
+  u64 hi = 0;
+  u64 lo = _umul128(a, b, &hi);
+  return lo ^ hi;
+#else
+  __uint128_t product = (__uint128_t)a * b;
+  return (u64)product ^ (u64)(product >> 64);
+#endif
+}
+
+// runs stripes through the accumulators, scrambling at block boundaries
+static void hash64_stripes(Hash64 *h, const u8 *data, u64 stripes) {
+  const HashKernel &kernel = hash_kernel();
+  const u8 *secret = hash_secret();
+
+  while (stripes > 0) {
+    u64 n = std::min(stripes, BLOCK_STRIPES - h->stripe);
+    kernel.accumulate(h->acc, data, secret + h->stripe * 8, n);
+    h->stripe += (u32)n;
+    data += n * 64;
+    stripes -= n;
+
+    if (h->stripe == BLOCK_STRIPES) {
+      kernel.scramble(h->acc, secret + SECRET_SIZE - 64);
+      h->stripe = 0;
+    }
+  }
+}
+
+void hash64_init(Hash64 *h) {
+  static const u64 init[8] = {
+      PRIME32_1,          PRIME64_1,          0xc2b2ae3d27d4eb4f,
+      0x165667b19e3779f9, 0x85ebca77c2b2ae63, 0x27d4eb2f165667c5,
+      0x9e3779b97f4a7c15, 0xff51afd7ed558ccd,
+  };
+  memcpy(h->acc, init, sizeof(init));
+  h->buf_len = 0;
+  h->stripe = 0;
+  h->total = 0;
+}
+
+void hash64_update(Hash64 *h, const void *data, u64 len) {
+  auto p = (const u8 *)data;
+  h->total += len;
+
+  if (h->buf_len > 0) {
+    u64 n = std::min<u64>(len, sizeof(h->buf) - h->buf_len);
+    memcpy(h->buf + h->buf_len, p, n);
+    h->buf_len += (u32)n;
+    p += n;
+    len -= n;
+
+    if (h->buf_len < sizeof(h->buf)) {
+      return;
+    }
+    hash64_stripes(h, h->buf, 1);
+    h->buf_len = 0;
+  }
+
+  u64 stripes = len / 64;
+  hash64_stripes(h, p, stripes);
+  p += stripes * 64;
+  len -= stripes * 64;
+
+  memcpy(h->buf, p, len);
+  h->buf_len = (u32)len;
+}
+
+u64 hash64_final(const Hash64 *h) {
+  Hash64 last = *h;
+
+  // the tail is padded with zeros. the length is mixed in below, so inputs
+  // that only differ by trailing zeros still hash differently
+  if (last.buf_len > 0) {
+    memset(last.buf + last.buf_len, 0, sizeof(last.buf) - last.buf_len);
+    hash64_stripes(&last, last.buf, 1);
+  }
+
+  const u8 *secret = hash_secret();
+  u64 result = last.total * PRIME64_1;
+  for (i32 i = 0; i < 4; i++) {
+    const u8 *key = secret + 11 + i * 16;
+    result += mul128_fold64(last.acc[i * 2] ^ read_u64(key),
+                            last.acc[i * 2 + 1] ^ read_u64(key + 8));
+  }
+
+  result ^= result >> 37;
+  result *= 0x165667919e3779f9;
+  result ^= result >> 32;
+  return result;
+}
+
+u64 hash64(const void *data, u64 len) {
+  Hash64 h;
+  hash64_init(&h);
+  hash64_update(&h, data, len);
+  return hash64_final(&h);
+}
+
+static const u32 SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static u32 rotr(u32 x, i32 n) { return (x >> n) | (x << (32 - n)); }
+
+static void sha256_block(u32 *state, const u8 *block) {
+  u32 w[64];
+  for (i32 i = 0; i < 16; i++) {
+    const u8 *p = block + i * 4;
+    w[i] = ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+  }
+  for (i32 i = 16; i < 64; i++) {
+    u32 s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    u32 s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  u32 a = state[0], b = state[1], c = state[2], d = state[3];
+  u32 e = state[4], f = state[5], g = state[6], h = state[7];
+  for (i32 i = 0; i < 64; i++) {
+    u32 s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+    u32 ch = (e & f) ^ (~e & g);
+    u32 t1 = h + s1 + ch + SHA256_K[i] + w[i];
+    u32 s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+    u32 maj = (a & b) ^ (a & c) ^ (b & c);
+    u32 t2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void sha256_init(Sha256 *h) {
+  static const u32 init[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(h->state, init, sizeof(init));
+  h->buf_len = 0;
+  h->total = 0;
+}
+
+void sha256_update(Sha256 *h, const void *data, u64 len) {
+  auto p = (const u8 *)data;
+  h->total += len;
+
+  if (h->buf_len > 0) {
+    u64 n = std::min<u64>(len, sizeof(h->buf) - h->buf_len);
+    memcpy(h->buf + h->buf_len, p, n);
+    h->buf_len += (u32)n;
+    p += n;
+    len -= n;
+
+    if (h->buf_len < sizeof(h->buf)) {
+      return;
+    }
+    sha256_block(h->state, h->buf);
+    h->buf_len = 0;
+  }
+
+  for (; len >= 64; p += 64, len -= 64) {
+    sha256_block(h->state, p);
+  }
+
+  memcpy(h->buf, p, len);
+  h->buf_len = (u32)len;
+}
+
+void sha256_final(Sha256 *h, u8 out[32]) {
+  u64 bits = h->total * 8;
+
+  u8 pad[72] = {0x80};
+  u64 pad_len = (h->buf_len < 56 ? 56 : 120) - h->buf_len;
+  for (i32 i = 0; i < 8; i++) {
+    pad[pad_len + i] = (u8)(bits >> (56 - i * 8));
+  }
+  sha256_update(h, pad, pad_len + 8);
+
+  for (i32 i = 0; i < 8; i++) {
+    out[i * 4] = (u8)(h->state[i] >> 24);
+    out[i * 4 + 1] = (u8)(h->state[i] >> 16);
+    out[i * 4 + 2] = (u8)(h->state[i] >> 8);
+    out[i * 4 + 3] = (u8)h->state[i];
+  }
+}
+
+struct TreeNode {
+  u8 hash[32];
+};
+
+// leaves and inner nodes get different prefixes, so a leaf can't be passed
+// off as a pair of nodes
+static void hash_tree_leaf(const u8 *data, u64 len, TreeNode *out) {
+  u8 prefix = 0;
+  Sha256 h;
+  sha256_init(&h);
+  sha256_update(&h, &prefix, 1);
+  sha256_update(&h, data, len);
+  sha256_final(&h, out->hash);
+}
+
+static void hash_tree_node(const TreeNode &lhs, const TreeNode &rhs,
+                           TreeNode *out) {
+  u8 prefix = 1;
+  Sha256 h;
+  sha256_init(&h);
+  sha256_update(&h, &prefix, 1);
+  sha256_update(&h, lhs.hash, sizeof(lhs.hash));
+  sha256_update(&h, rhs.hash, sizeof(rhs.hash));
+  sha256_final(&h, out->hash);
+}
+
+static bool file_seek(FILE *fp, u64 offset) {
+#ifdef _WIN32
+  return _fseeki64(fp, (i64)offset, SEEK_SET) == 0;
+#else
+  return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static FILE *file_open(const char *path) {
+#ifdef _WIN32
+  FILE *fp = nullptr;
+  return fopen_s(&fp, path, "rb") ? nullptr : fp;
+#else
+  return fopen(path, "rb");
+#endif
+}
+
+static void hash_pool_worker(HashPool *pool) {
+  u64 seen = 0;
+  std::unique_lock lock(pool->mtx);
+  while (true) {
+    pool->cv.wait(lock, [&]() { return pool->quit || pool->job != seen; });
+    if (pool->quit) {
+      return;
+    }
+    seen = pool->job;
+
+    lock.unlock();
+    pool->work(pool->ctx);
+    lock.lock();
+
+    if (--pool->busy == 0) {
+      pool->done_cv.notify_one();
+    }
+  }
+}
+
+void hash_pool_start(HashPool *pool, u32 threads) {
+  pool->quit = false;
+  for (u32 i = 1; i < threads; i++) {
+    pool->threads.emplace_back(hash_pool_worker, pool);
+  }
+}
+
+void hash_pool_stop(HashPool *pool) {
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->quit = true;
+  }
+  pool->cv.notify_all();
+  for (auto &thread : pool->threads) {
+    thread.join();
+  }
+  pool->threads.clear();
+}
+
+// runs work on every worker and the calling thread, and returns once they
+// are all done
+static void hash_pool_run(HashPool *pool, void (*work)(void *ctx),
+                          void *ctx) {
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->work = work;
+    pool->ctx = ctx;
+    pool->busy = (u32)pool->threads.size();
+    pool->job++;
+  }
+  pool->cv.notify_all();
+
+  work(ctx);
+
+  std::unique_lock lock(pool->mtx);
+  pool->done_cv.wait(lock, [&]() { return pool->busy == 0; });
+}
+
+// a file being hashed, shared by the threads that take its leaves
+struct TreeJob {
+  const char *path;
+  u64 size;
+  u64 count;
+  TreeNode *nodes;
+  std::atomic<u64> next = 0;
+  std::atomic<bool> failed = false;
+};
+
+// every thread has its own file and buffer and takes the next leaf. the
+// file is only opened once there's a leaf left for it
+static void hash_tree_work(void *ctx) {
+  auto job = (TreeJob *)ctx;
+  FILE *fp = nullptr;
+  defer(if (fp) { fclose(fp); });
+  std::vector<u8> buf;
+
+  for (u64 i = job->next++; i < job->count && !job->failed; i = job->next++) {
+    if (!fp) {
+      fp = file_open(job->path);
+      if (!fp) {
+        job->failed = true;
+        return;
+      }
+      buf.resize(HASH_TREE_LEAF);
+    }
+
+    u64 offset = i * HASH_TREE_LEAF;
+    u64 len = std::min(HASH_TREE_LEAF, job->size - offset);
+    if (!file_seek(fp, offset) || fread(buf.data(), 1, len, fp) != len) {
+      job->failed = true;
+      return;
+    }
+    hash_tree_leaf(buf.data(), len, &job->nodes[i]);
+  }
+}
+
+bool hash_tree_file(HashPool *pool, const char *path, u8 out[32]) {
+  FILE *fp = file_open(path);
+  if (!fp) {
+    return false;
+  }
+  defer(fclose(fp));
+
+  if (fseek(fp, 0, SEEK_END)) {
+    return false;
+  }
+#ifdef _WIN32
+  u64 size = (u64)_ftelli64(fp);
+#else
+  u64 size = (u64)ftello(fp);
+#endif
+
+  u64 count = std::max<u64>((size + HASH_TREE_LEAF - 1) / HASH_TREE_LEAF, 1);
+  std::vector<TreeNode> nodes(count);
+
+  TreeJob job;
+  job.path = path;
+  job.size = size;
+  job.count = count;
+  job.nodes = nodes.data();
+  hash_pool_run(pool, hash_tree_work, &job);
+  if (job.failed) {
+    return false;
+  }
+
+  // an odd node at the end of a level moves up unchanged
+  while (nodes.size() > 1) {
+    u64 half = nodes.size() / 2;
+    for (u64 i = 0; i < half; i++) {
+      hash_tree_node(nodes[i * 2], nodes[i * 2 + 1], &nodes[i]);
+    }
+    if (nodes.size() % 2) {
+      nodes[half] = nodes.back();
+      half++;
+    }
+    nodes.resize(half);
+  }
+
+  memcpy(out, nodes[0].hash, sizeof(nodes[0].hash));
+  return true;
+}
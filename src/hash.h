@@ -0,0 +1,72 @@
+#pragma once
+
+#include "language.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fast non-cryptographic 64-bit hash, built like xxh3's long input loop.
+// eight 64-bit lanes take 64 byte stripes, and the lanes are scrambled
+// after every block of stripes. the result doesn't depend on how the input
+// is split across hash64_update calls
+struct Hash64 {
+  u64 acc[8];
+  u8 buf[64];
+  u32 buf_len;
+  u32 stripe; // stripes accumulated in the current block
+  u64 total;
+};
+
+void hash64_init(Hash64 *h);
+void hash64_update(Hash64 *h, const void *data, u64 len);
+u64 hash64_final(const Hash64 *h);
+u64 hash64(const void *data, u64 len);
+
+// name of the kernel picked for this cpu: "avx2", "sse2" or "scalar"
+const char *hash64_kernel();
+
+// makes later hashes use the named kernel, so tests can compare them. not
+// safe while other threads hash. returns false if this cpu can't run it
+bool hash64_use_kernel(const char *name);
+
+#if defined(__x86_64__) || defined(_M_X64)
+// checks the os saves ymm registers too, not just the cpuid bit
+bool cpu_has_avx2();
+#endif
+
+struct Sha256 {
+  u32 state[8];
+  u8 buf[64];
+  u32 buf_len;
+  u64 total;
+};
+
+void sha256_init(Sha256 *h);
+void sha256_update(Sha256 *h, const void *data, u64 len);
+void sha256_final(Sha256 *h, u8 out[32]);
+
+// merkle tree of sha-256 hashes over fixed-size leaves. leaves are read and
+// hashed on several threads, so large files hash at disk speed
+constexpr u64 HASH_TREE_LEAF = 1024 * 1024;
+
+// workers that hash the leaves along with the calling thread. they stay up
+// between files, so a small file doesn't pay for starting threads. a pool
+// hashes one file at a time
+struct HashPool {
+  std::vector<std::thread> threads;
+  std::mutex mtx;
+  std::condition_variable cv;      // wakes the workers
+  std::condition_variable done_cv; // a worker finished its part
+  void (*work)(void *ctx) = nullptr;
+  void *ctx = nullptr;
+  u64 job = 0; // bumped for every file
+  u32 busy = 0;
+  bool quit = false;
+};
+
+// threads counts the calling thread, so 1 starts no workers
+void hash_pool_start(HashPool *pool, u32 threads);
+void hash_pool_stop(HashPool *pool);
+
+bool hash_tree_file(HashPool *pool, const char *path, u8 out[32]);
@@ -0,0 +1,602 @@
+#include "index.h"
+#include "hash.h"
+#include <algorithm>
+#include <filesystem>
+#include <string.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+constexpr u32 INDEX_MAGIC = 0x58495346; // "FSIX"
+constexpr u32 INDEX_VERSION = 1;
+
+struct IndexHeader {
+  u32 magic;
+  u32 version;
+  u64 count;
+  u64 heap_size;
+};
+
+struct IndexRecord {
+  u32 path; // offset into the heap
+  u32 path_len;
+  u64 size;
+  u64 hash;
+  u32 mtime;
+  u32 flags; // reserved
+};
+
+static_assert(sizeof(IndexHeader) == 24);
+static_assert(sizeof(IndexRecord) == 32);
+
+// log records are a checksum followed by this and the path bytes
+struct WalRecord {
+  u32 path_len;
+  u32 mtime;
+  u64 size;
+  u64 hash;
+};
+
+static_assert(sizeof(WalRecord) == 24);
+
+// longer than any path a log records, windows' long paths included. a
+// length past it is a corrupt record, not something to allocate
+constexpr u32 LOG_PATH_MAX = 128 * 1024;
+
+static bool map_file(MappedFile *m, const std::string &path) {
+#ifdef _WIN32
+  HANDLE file = CreateFileW(fs::path(path).c_str(), GENERIC_READ,
+                            FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER size = {};
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void *data =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!data) {
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    return false;
+  }
+
+  m->data = (const u8 *)data;
+  m->size = (u64)size.QuadPart;
+  m->file = file;
+  m->mapping = mapping;
+  return true;
+#else
+  i32 fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st = {};
+  if (fstat(fd, &st) || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  m->data = (const u8 *)data;
+  m->size = (u64)st.st_size;
+  m->fd = fd;
+  return true;
+#endif
+}
+
+static void unmap_file(MappedFile *m) {
+  if (!m->data) {
+    return;
+  }
+
+#ifdef _WIN32
+  UnmapViewOfFile(m->data);
+  CloseHandle(m->mapping);
+  CloseHandle(m->file);
+#else
+  munmap((void *)m->data, m->size);
+  close(m->fd);
+#endif
+
+  *m = {};
+}
+
+static FILE *open_file(const std::string &path, const char *mode) {
+#ifdef _WIN32
+  FILE *fp = nullptr;
+  return fopen_s(&fp, path.data(), mode) ? nullptr : fp;
+#else
+  return fopen(path.data(), mode);
+#endif
+}
+
+static bool sync_file(FILE *fp) {
+  if (fflush(fp)) {
+    return false;
+  }
+#ifdef _WIN32
+  return _commit(_fileno(fp)) == 0;
+#else
+  return fdatasync(fileno(fp)) == 0;
+#endif
+}
+
+static std::string wal_path(const IndexStore *store) {
+  return store->path + ".wal";
+}
+
+static u32 wal_checksum(const WalRecord &rec, const char *path) {
+  Hash64 h;
+  hash64_init(&h);
+  hash64_update(&h, &rec, sizeof(rec));
+  hash64_update(&h, path, rec.path_len);
+  return (u32)hash64_final(&h);
+}
+
+// a snapshot that fails any check is ignored, the log and the next
+// reconcile fill the index back in
+static bool load_snapshot(IndexStore *store) {
+  if (!map_file(&store->snapshot, store->path)) {
+    return false;
+  }
+
+  const MappedFile &m = store->snapshot;
+  IndexHeader header;
+  if (m.size < sizeof(header)) {
+    unmap_file(&store->snapshot);
+    return false;
+  }
+  memcpy(&header, m.data, sizeof(header));
+
+  u64 records_size = header.count * sizeof(IndexRecord);
+  if (header.magic != INDEX_MAGIC || header.version != INDEX_VERSION ||
+      header.count > m.size / sizeof(IndexRecord) ||
+      sizeof(header) + records_size + header.heap_size != m.size) {
+    unmap_file(&store->snapshot);
+    return false;
+  }
+
+  store->records = (const IndexRecord *)(m.data + sizeof(header));
+  store->count = header.count;
+  store->heap = (const char *)m.data + sizeof(header) + records_size;
+  store->heap_size = header.heap_size;
+  return true;
+}
+
+// returns false if the log ends with a torn record
+static bool replay_wal(IndexStore *store) {
+  FILE *fp = open_file(wal_path(store), "rb");
+  if (!fp) {
+    return true;
+  }
+  defer(fclose(fp));
+
+  std::string path;
+  while (true) {
+    u32 checksum = 0;
+    WalRecord rec;
+    u64 n = fread(&checksum, 1, sizeof(checksum), fp);
+    if (n == 0) {
+      return true;
+    }
+
+    if (n != sizeof(checksum) || fread(&rec, sizeof(rec), 1, fp) != 1) {
+      return false;
+    }
+
+    if (rec.path_len > LOG_PATH_MAX) {
+      return false;
+    }
+
+    path.resize(rec.path_len);
+    if (fread(path.data(), 1, rec.path_len, fp) != rec.path_len ||
+        wal_checksum(rec, path.data()) != checksum) {
+      return false;
+    }
+
+    store->overlay[path] = {rec.size, rec.mtime, rec.hash};
+  }
+}
+
+bool index_open(IndexStore *store, const std::string &path) {
+  store->path = path;
+
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+
+  load_snapshot(store);
+  bool clean = replay_wal(store);
+
+  // appending after a torn record would hide everything written later
+  if (!clean && !index_compact(store)) {
+    return false;
+  }
+
+  store->wal = open_file(wal_path(store), "ab");
+  return store->wal != nullptr;
+}
+
+void index_close(IndexStore *store) {
+  if (!store->overlay.empty()) {
+    index_compact(store);
+  }
+
+  if (store->wal) {
+    fclose(store->wal);
+  }
+  unmap_file(&store->snapshot);
+  *store = {};
+}
+
+static std::string_view record_path(const IndexStore *store,
+                                    const IndexRecord &rec) {
+  if ((u64)rec.path + rec.path_len > store->heap_size) {
+    return {};
+  }
+  return std::string_view(store->heap + rec.path, rec.path_len);
+}
+
+std::optional<IndexEntry> index_get(IndexStore *store, std::string_view key) {
+  auto it = store->overlay.find(std::string(key));
+  if (it != store->overlay.end()) {
+    return it->second;
+  }
+
+  const IndexRecord *end = store->records + store->count;
+  const IndexRecord *rec = std::lower_bound(
+      store->records, end, key, [&](const IndexRecord &rec, auto key) {
+        return record_path(store, rec) < key;
+      });
+  if (rec == end || record_path(store, *rec) != key) {
+    return std::nullopt;
+  }
+
+  return IndexEntry{rec->size, rec->mtime, rec->hash};
+}
+
+void index_set(IndexStore *store, const std::string &key, IndexEntry entry) {
+  store->overlay[key] = entry;
+
+  if (store->wal) {
+    WalRecord rec = {(u32)key.size(), entry.mtime, entry.size, entry.hash};
+    u32 checksum = wal_checksum(rec, key.data());
+    fwrite(&checksum, sizeof(checksum), 1, store->wal);
+    fwrite(&rec, sizeof(rec), 1, store->wal);
+    fwrite(key.data(), 1, key.size(), store->wal);
+    fflush(store->wal);
+  }
+
+  if (store->overlay.size() >= INDEX_COMPACT_AT) {
+    index_compact(store);
+  }
+}
+
+// merges the overlay into a new snapshot. the snapshot is replaced before
+// the log is cleared, and replaying the log over the new snapshot again is
+// harmless, so a crash at any point loses nothing
+bool index_compact(IndexStore *store) {
+  std::vector<const std::pair<const std::string, IndexEntry> *> updates;
+  updates.reserve(store->overlay.size());
+  for (auto &kv : store->overlay) {
+    updates.push_back(&kv);
+  }
+  std::sort(updates.begin(), updates.end(),
+            [](auto lhs, auto rhs) { return lhs->first < rhs->first; });
+
+  std::vector<IndexRecord> records;
+  std::string heap;
+  records.reserve(store->count + updates.size());
+
+  auto add = [&](std::string_view key, IndexEntry entry) {
+    IndexRecord rec = {};
+    rec.path = (u32)heap.size();
+    rec.path_len = (u32)key.size();
+    rec.size = entry.size;
+    rec.hash = entry.hash;
+    rec.mtime = entry.mtime;
+    records.push_back(rec);
+    heap.append(key);
+  };
+
+  u64 i = 0;
+  for (auto update : updates) {
+    for (; i < store->count; i++) {
+      const IndexRecord &rec = store->records[i];
+      std::string_view key = record_path(store, rec);
+      if (key >= update->first) {
+        break;
+      }
+      add(key, {rec.size, rec.mtime, rec.hash});
+    }
+
+    if (i < store->count &&
+        record_path(store, store->records[i]) == update->first) {
+      i++;
+    }
+    add(update->first, update->second);
+  }
+
+  for (; i < store->count; i++) {
+    const IndexRecord &rec = store->records[i];
+    add(record_path(store, rec), {rec.size, rec.mtime, rec.hash});
+  }
+
+  std::string tmp = store->path + ".tmp";
+  FILE *fp = open_file(tmp, "wb");
+  if (!fp) {
+    return false;
+  }
+
+  IndexHeader header = {INDEX_MAGIC, INDEX_VERSION, records.size(),
+                        heap.size()};
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok &= fwrite(records.data(), sizeof(IndexRecord), records.size(), fp) ==
+        records.size();
+  ok &= fwrite(heap.data(), 1, heap.size(), fp) == heap.size();
+  // on disk before it replaces the old one, or a crash could leave a
+  // renamed but empty snapshot
+  ok &= sync_file(fp);
+  ok &= fclose(fp) == 0;
+  if (!ok) {
+    return false;
+  }
+
+#ifdef _WIN32
+  // windows can't replace a file that's still mapped
+  unmap_file(&store->snapshot);
+  store->records = nullptr;
+  store->count = 0;
+#endif
+
+  std::error_code ec;
+  fs::rename(tmp, store->path, ec);
+  if (ec) {
+#ifdef _WIN32
+    // the old snapshot is still in place
+    load_snapshot(store);
+#endif
+    return false;
+  }
+
+  // a replaced file stays readable while it's mapped, so the store keeps
+  // reading the old snapshot if the new one can't be mapped. windows
+  // unmapped it above and is left with only the overlay
+  MappedFile old = store->snapshot;
+  store->snapshot = {};
+  if (!load_snapshot(store)) {
+    store->snapshot = old;
+    return false;
+  }
+  unmap_file(&old);
+
+  if (store->wal) {
+    fclose(store->wal);
+  }
+  store->wal = open_file(wal_path(store), "wb");
+  store->overlay.clear();
+  return true;
+}
+
+enum class JournalOp : u32 {
+  Add = 1,
+  Done = 2,
+};
+
+// followed by a checksum of the header and the strings, then the strings
+struct JournalRecord {
+  JournalOp op;
+  u32 filename_len;
+  u32 local_len;
+  u32 remote_len;
+};
+
+static_assert(sizeof(JournalRecord) == 16);
+
+static void journal_record(std::string *out, JournalOp op,
+                           const JournalEntry &entry) {
+  JournalRecord rec = {op, (u32)entry.filename.size(),
+                       (u32)entry.local.size(), (u32)entry.remote.size()};
+
+  Hash64 h;
+  hash64_init(&h);
+  hash64_update(&h, &rec, sizeof(rec));
+  hash64_update(&h, entry.filename.data(), entry.filename.size());
+  hash64_update(&h, entry.local.data(), entry.local.size());
+  hash64_update(&h, entry.remote.data(), entry.remote.size());
+  u32 checksum = (u32)hash64_final(&h);
+
+  out->append((const char *)&rec, sizeof(rec));
+  out->append((const char *)&checksum, sizeof(checksum));
+  out->append(entry.filename);
+  out->append(entry.local);
+  out->append(entry.remote);
+}
+
+// stops at the first torn or corrupt record, everything after it was
+// written after the crash point anyway
+static void journal_replay(UploadJournal *journal) {
+  FILE *fp = open_file(journal->path, "rb");
+  if (!fp) {
+    return;
+  }
+  defer(fclose(fp));
+
+  std::string check;
+  while (true) {
+    JournalRecord rec;
+    u32 checksum = 0;
+    if (fread(&rec, sizeof(rec), 1, fp) != 1 ||
+        fread(&checksum, sizeof(checksum), 1, fp) != 1) {
+      return;
+    }
+
+    if (rec.filename_len > LOG_PATH_MAX || rec.local_len > LOG_PATH_MAX ||
+        rec.remote_len > LOG_PATH_MAX) {
+      return;
+    }
+
+    JournalEntry entry;
+    entry.filename.resize(rec.filename_len);
+    entry.local.resize(rec.local_len);
+    entry.remote.resize(rec.remote_len);
+    if (fread(entry.filename.data(), 1, rec.filename_len, fp) !=
+            rec.filename_len ||
+        fread(entry.local.data(), 1, rec.local_len, fp) != rec.local_len ||
+        fread(entry.remote.data(), 1, rec.remote_len, fp) != rec.remote_len) {
+      return;
+    }
+
+    check.clear();
+    journal_record(&check, rec.op, entry);
+    if (memcmp(check.data() + sizeof(rec), &checksum, sizeof(checksum))) {
+      return;
+    }
+
+    if (rec.op == JournalOp::Add) {
+      entry.seq = ++journal->seq;
+      journal->pending[entry.remote] = std::move(entry);
+    } else if (rec.op == JournalOp::Done) {
+      journal->pending.erase(entry.remote);
+    }
+  }
+}
+
+// replaces the file with one add record per pending upload
+static bool journal_rewrite(UploadJournal *journal) {
+  std::string data;
+  for (auto &[remote, entry] : journal->pending) {
+    journal_record(&data, JournalOp::Add, entry);
+  }
+
+  std::string tmp = journal->path + ".tmp";
+  FILE *fp = open_file(tmp, "wb");
+  if (!fp) {
+    return false;
+  }
+
+  bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  ok &= sync_file(fp);
+  ok &= fclose(fp) == 0;
+  if (!ok) {
+    return false;
+  }
+
+  if (journal->fp) {
+    fclose(journal->fp);
+    journal->fp = nullptr;
+  }
+
+  std::error_code ec;
+  fs::rename(tmp, journal->path, ec);
+  if (ec) {
+    return false;
+  }
+
+  journal->fp = open_file(journal->path, "ab");
+  journal->records = journal->pending.size();
+  return journal->fp != nullptr;
+}
+
+bool journal_open(UploadJournal *journal, const std::string &path,
+                  std::vector<JournalEntry> *pending) {
+  std::lock_guard lock(journal->mtx);
+  journal->path = path;
+
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+
+  // coalesced on the way in, and written back without the finished ones
+  // and any torn tail
+  journal_replay(journal);
+  if (!journal_rewrite(journal)) {
+    return false;
+  }
+
+  for (auto &[remote, entry] : journal->pending) {
+    pending->push_back(entry);
+  }
+  return true;
+}
+
+void journal_close(UploadJournal *journal) {
+  journal_sync(journal);
+
+  std::lock_guard lock(journal->mtx);
+  if (journal->fp) {
+    fclose(journal->fp);
+  }
+  journal->fp = nullptr;
+  journal->buf.clear();
+  journal->records = 0;
+  journal->seq = 0;
+  journal->pending.clear();
+}
+
+u64 journal_add(UploadJournal *journal, const JournalEntry &entry) {
+  std::lock_guard lock(journal->mtx);
+  JournalEntry &added = journal->pending[entry.remote];
+  added = entry;
+  added.seq = ++journal->seq;
+  journal_record(&journal->buf, JournalOp::Add, entry);
+  journal->records++;
+  return added.seq;
+}
+
+void journal_done(UploadJournal *journal, const std::string &remote, u64 seq) {
+  std::lock_guard lock(journal->mtx);
+  auto it = journal->pending.find(remote);
+  if (it == journal->pending.end() || it->second.seq != seq) {
+    return;
+  }
+  journal->pending.erase(it);
+
+  JournalEntry entry;
+  entry.remote = remote;
+  journal_record(&journal->buf, JournalOp::Done, entry);
+  journal->records++;
+}
+
+// writes the buffered records with one fsync. the file is rewritten once
+// most of its records are dead
+bool journal_sync(UploadJournal *journal) {
+  std::lock_guard lock(journal->mtx);
+  if (!journal->fp || journal->buf.empty()) {
+    return true;
+  }
+
+  if (journal->records > 4 * journal->pending.size() + 1024) {
+    journal->buf.clear();
+    return journal_rewrite(journal);
+  }
+
+  bool ok = fwrite(journal->buf.data(), 1, journal->buf.size(),
+                   journal->fp) == journal->buf.size();
+  journal->buf.clear();
+  return sync_file(journal->fp) && ok;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "language.h"
+#include <mutex>
+#include <optional>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// what the remote last received for a path
+struct IndexEntry {
+  u64 size = 0;
+  u32 mtime = 0;
+  u64 hash = 0;
+};
+
+struct MappedFile {
+  const u8 *data = nullptr;
+  u64 size = 0;
+#ifdef _WIN32
+  void *file = nullptr;
+  void *mapping = nullptr;
+#else
+  i32 fd = -1;
+#endif
+};
+
+struct IndexRecord;
+
+// persistent path -> entry map. a snapshot of sorted fixed-size records and
+// a string heap is memory-mapped and searched in place, so opening costs
+// the same for any number of paths. updates go to a write-ahead log and an
+// in-memory overlay until they're folded into a new snapshot
+struct IndexStore {
+  std::string path; // the snapshot, the log is next to it
+  MappedFile snapshot;
+  const IndexRecord *records = nullptr;
+  u64 count = 0;
+  const char *heap = nullptr;
+  u64 heap_size = 0;
+
+  FILE *wal = nullptr;
+  std::unordered_map<std::string, IndexEntry> overlay;
+};
+
+// updates kept in the overlay before they're written into the snapshot
+constexpr u64 INDEX_COMPACT_AT = 64 * 1024;
+
+bool index_open(IndexStore *store, const std::string &path);
+void index_close(IndexStore *store);
+std::optional<IndexEntry> index_get(IndexStore *store, std::string_view key);
+void index_set(IndexStore *store, const std::string &key, IndexEntry entry);
+bool index_compact(IndexStore *store);
+
+// an upload that hasn't finished yet
+struct JournalEntry {
+  std::string filename;
+  std::string local;
+  std::string remote;
+  u64 seq = 0; // numbers the adds of this run, it isn't written
+};
+
+// append-only log of uploads that were queued and haven't succeeded, so
+// they're picked up again after a crash or a dropped connection. records
+// are buffered and written with one fsync per sync call
+struct UploadJournal {
+  std::mutex mtx;
+  std::string path;
+  FILE *fp = nullptr;
+  std::string buf; // records not written yet
+  u64 records = 0; // in the file, live or not
+  u64 seq = 0;     // of the last add
+  std::unordered_map<std::string, JournalEntry> pending; // by remote path
+};
+
+// returns the uploads left pending by the last run, latest per remote path
+bool journal_open(UploadJournal *journal, const std::string &path,
+                  std::vector<JournalEntry> *pending);
+void journal_close(UploadJournal *journal);
+// returns the add's seq, which the upload hands back to journal_done
+u64 journal_add(UploadJournal *journal, const JournalEntry &entry);
+// does nothing if the path was added again after seq, that upload may
+// have read the file before it changed
+void journal_done(UploadJournal *journal, const std::string &remote, u64 seq);
+bool journal_sync(UploadJournal *journal);
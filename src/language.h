@@ -1,6 +1,11 @@
 #pragma once
 
+#include <coroutine>
+#include <exception>
+#include <optional>
 #include <stdint.h>
+#include <type_traits>
+#include <utility>
 
 #define array_size(a) (sizeof(a) / sizeof(a[0]))
 
@@ -12,6 +17,8 @@ using u8 = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
 using u64 = uint64_t;
+using f32 = float;
+using f64 = double;
 
 // using isize = ptrdiff_t;
 // using usize = size_t;
@@ -27,4 +34,90 @@ template <class F> Defer<F> defer_func(F f) { return Defer<F>(f); }
 #define DEFER_1(x, y) x##y
 #define DEFER_2(x, y) DEFER_1(x, y)
 #define defer(code)                                                            \
-  auto DEFER_2(_defer_, __COUNTER__) = defer_func([&]() { code; })
\ No newline at end of file
+  auto DEFER_2(_defer_, __COUNTER__) = defer_func([&]() { code; })
+
+// lazily started coroutine. awaiting a task runs it, and the awaiter resumes
+// when the task returns
+template <class T> struct Task;
+
+struct TaskFinal {
+  bool await_ready() noexcept { return false; }
+
+  template <class P>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+    auto next = h.promise().continuation;
+    return next ? next : std::noop_coroutine();
+  }
+
+  void await_resume() noexcept {}
+};
+
+template <class T> struct TaskPromise {
+  std::coroutine_handle<> continuation;
+  std::optional<T> value;
+
+  Task<T> get_return_object();
+  std::suspend_always initial_suspend() { return {}; }
+  TaskFinal final_suspend() noexcept { return {}; }
+  void return_value(T v) { value = std::move(v); }
+  void unhandled_exception() { std::terminate(); }
+};
+
+template <> struct TaskPromise<void> {
+  std::coroutine_handle<> continuation;
+
+  Task<void> get_return_object();
+  std::suspend_always initial_suspend() { return {}; }
+  TaskFinal final_suspend() noexcept { return {}; }
+  void return_void() {}
+  void unhandled_exception() { std::terminate(); }
+};
+
+template <class T = void> struct Task {
+  using promise_type = TaskPromise<T>;
+  std::coroutine_handle<promise_type> handle;
+
+  Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  Task(Task &&other) : handle(other.handle) { other.handle = nullptr; }
+  Task(const Task &) = delete;
+  ~Task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+    handle.promise().continuation = h;
+    return handle;
+  }
+
+  T await_resume() {
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*handle.promise().value);
+    }
+  }
+};
+
+template <class T> Task<T> TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+  using Handle = std::coroutine_handle<TaskPromise<void>>;
+  return Task<void>(Handle::from_promise(*this));
+}
+
+// runs a task to completion without anyone waiting on it
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+inline Detached spawn(Task<void> task) { co_await task; }
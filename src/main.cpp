@@ -5,20 +5,44 @@
 #include "deps/imgui_impl_opengl3.h"
 #include "deps/imgui_internal.h"
 #include "deps/imgui_stdlib.h"
+#include "filelist.h"
+#include "finder.h"
+#include "hash.h"
+#include "index.h"
+#include "match.h"
+#include "reader.h"
+#include "scan.h"
+#include "watch.h"
 #include "language.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <list>
 #include <libssh2.h>
 #include <libssh2_sftp.h>
-#include <shobjidl.h>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
 #include <unordered_map>
-#include <ws2tcpip.h>
+#include <unordered_set>
+#include <vector>
 
 #include <GLFW/glfw3.h>
 
+#ifdef _WIN32
+#include <shobjidl.h>
+#include <ws2tcpip.h>
+
 #define GLFW_EXPOSE_NATIVE_WIN32
 #define GLFW_NATIVE_INCLUDE_NONE
 #include <GLFW/glfw3native.h>
@@ -28,10 +52,44 @@
 #pragma comment(lib, "comctl32.lib")
 #pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "Comdlg32.lib")
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// enough of winsock and the msvc crt for the code below to be shared
+using SOCKET = i32;
+using WSAPOLLFD = pollfd;
+using errno_t = i32;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr i32 SD_BOTH = SHUT_RDWR;
+constexpr i32 MAX_PATH = PATH_MAX;
+
+static i32 closesocket(SOCKET sock) { return close(sock); }
+
+static i32 WSAPoll(WSAPOLLFD *fds, u32 count, i32 timeout_ms) {
+  return poll(fds, count, timeout_ms);
+}
+
+static errno_t fopen_s(FILE **fp, const char *path, const char *mode) {
+  *fp = fopen(path, mode);
+  return *fp ? 0 : errno;
+}
+#endif
 
 namespace fs = std::filesystem;
 
 constexpr const char *CONFIG_PATH = "./config.txt";
+// upload indexes and journals, one of each per server and user
+constexpr const char *INDEX_DIR = "./index";
 
 struct Config {
   std::string user;
@@ -40,151 +98,492 @@ struct Config {
 
   std::string local_dir;
   std::string remote_dir;
+
+  // KiB of outstanding writes per upload. 0 sizes the window from the
+  // measured round trip time and throughput
+  u32 write_window = 0;
+
+  // upload sessions, spread over the io threads. every thread drives its
+  // sessions with non-blocking io
+  u32 transfer_sessions = 4;
+  u32 transfer_threads = 1;
+
+  // authenticated sessions kept ready to replace one that drops
+  u32 standby_sessions = 1;
+
+  // ms a file has to go without changes before it's uploaded. editors
+  // write a save in several steps
+  u32 quiet_ms = 100;
 };
 
-enum class FileKind : i32 {
-  None,
-  File,
-  Dir,
+// sftp v3 packet types, see draft-ietf-secsh-filexfer-02
+enum class SftpType : u8 {
+  Init = 1,
+  Version = 2,
+  Open = 3,
+  Close = 4,
+  Read = 5,
+  Write = 6,
+  Lstat = 7,
+  Fstat = 8,
+  Setstat = 9,
+  Fsetstat = 10,
+  Opendir = 11,
+  Readdir = 12,
+  Remove = 13,
+  Mkdir = 14,
+  Rmdir = 15,
+  Realpath = 16,
+  Stat = 17,
+  Rename = 18,
+  Status = 101,
+  Handle = 102,
+  Data = 103,
+  Name = 104,
+  Attrs = 105,
 };
 
-struct File {
-  std::string name;
-  FileKind kind = FileKind::None;
+struct SftpReply {
+  SftpType type = SftpType::Status;
+  u32 status = 0;
+  std::string body; // packet contents after the request id
+};
+
+struct SftpAttrs {
+  u32 flags = 0;
   u64 size = 0;
+  u32 permissions = 0;
+  u32 atime = 0;
+  u32 mtime = 0;
+};
+
+struct SftpName {
+  std::string name;
+  SftpAttrs attrs;
+};
+
+struct SftpSent {
+  f64 at = 0;
+  u32 write_len = 0; // non-zero for WRITE requests
+};
+
+// raw sftp channel that lets requests be pipelined. libssh2's sftp api waits
+// on one request at a time and hides request ids and write offsets.
+// coroutines suspend on the pipe until their reply arrives, see sftp_run
+struct SftpPipe {
+  LIBSSH2_CHANNEL *channel = nullptr;
+  u32 next_id = 1;
+  std::string out;
+  u64 out_pos = 0;
+  std::string in;
+  std::unordered_map<u32, SftpReply> replies;
+  std::unordered_map<u32, SftpSent> sent;
+  bool failed = false;
+
+  std::unordered_map<u32, std::coroutine_handle<>> waiters;
+  std::deque<std::coroutine_handle<>> window_waiters;
+  std::vector<std::coroutine_handle<>> yielded;
+
+  u32 write_window = 0; // KiB, 0 sizes it from the estimates below
+  u64 inflight_bytes = 0;
+  u64 acked = 0;
+  f64 busy_since = 0;
+  f64 heard_at = 0; // last read, or when requests started to be outstanding
+
+  // link estimates used to size the write window. kept for the lifetime of
+  // the connection so later uploads start with a good window
+  f64 min_rtt = 0;
+  f64 throughput = 0;
 };
 
 struct Net {
   LIBSSH2_SESSION *session = nullptr;
   LIBSSH2_SFTP *sftp = nullptr;
+  SftpPipe *pipe = nullptr;
   SOCKET sock = 0;
 };
 
-struct FileChange {
-  std::string filename;
-  i32 type = 0;
+// lock-free queue with any number of producers and one consumer. the
+// consumer owns a dummy node at the tail, popping moves the value out of
+// the node after it, which then becomes the dummy
+struct ChangeNode {
+  std::atomic<ChangeNode *> next = nullptr;
+  FileChange change;
 };
 
-struct FileWatcher {
-  OVERLAPPED overlapped = {};
-  HANDLE dir = INVALID_HANDLE_VALUE;
-  void *buf = nullptr;
-  DWORD buf_size = 0;
-  std::vector<FileChange> changes;
-  std::unordered_map<std::string, i64> modtimes;
+struct ChangeQueue {
+  std::atomic<ChangeNode *> head;
+  ChangeNode *tail;
+
+  ChangeQueue() : head(new ChangeNode), tail(head.load()) {}
+  ChangeQueue(const ChangeQueue &) = delete;
+  ~ChangeQueue() {
+    while (tail) {
+      ChangeNode *next = tail->next;
+      delete tail;
+      tail = next;
+    }
+  }
+};
 
-  bool running() const { return dir != INVALID_HANDLE_VALUE; }
+struct TransferJob {
+  std::string filename; // relative to the local dir, used for logging
+  std::string local;
+  std::string remote;
+  f64 changed_at = 0; // when the watcher saw the change, 0 if it didn't
+  u64 journal_seq = 0; // of the journal add this upload finishes
 };
 
-struct App {
-  GLFWwindow *window = nullptr;
-  bool ran_first_update = false;
-  bool show_demo = false;
-  std::vector<File> local_working_dir;
-  std::vector<File> remote_working_dir;
-  std::vector<std::string> watcher_log;
+struct TransferResult {
+  TransferJob job;
+  bool ok = false;
+  bool unchanged = false; // the remote already had the contents
+  u64 size = 0;  // of the remote file once it's done
+  u32 mtime = 0; // set on the remote file, 0 if it wasn't
+  f64 seconds = 0;
+  f64 latency = 0; // from the change being seen to the upload starting
 };
 
-static void error_message(const wchar_t *msg) {
-  MessageBox(nullptr, msg, nullptr, 0);
-}
+// shared by every io thread, keyed by remote path. kept on disk, so files
+// uploaded in an earlier run aren't uploaded again
+struct UploadIndex {
+  std::mutex mtx;
+  IndexStore store;
+};
 
-static void watcher_init(FileWatcher *watcher,
-                         const std::filesystem::path &path) {
-  HANDLE dir =
-      CreateFile(path.c_str(), FILE_LIST_DIRECTORY,
-                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-                 nullptr, OPEN_EXISTING,
-                 FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
-  if (!dir) {
-    error_message(L"cannot create directory handle for file watcher");
-  }
+// every upload on one session runs as a coroutine on the session's pipe, so
+// OPEN, WRITE and CLOSE requests for different files are in flight together
+struct IoSession {
+  Net net;
+  UploadIndex *index = nullptr;
+  ReadThread *reads = nullptr; // the io thread's, shared by its sessions
+  std::deque<TransferJob> waiting;
+  u32 running = 0;
+  u64 buffered = 0; // bytes of chunk buffers held by running uploads
+  std::vector<TransferResult> results;
+};
 
-  OVERLAPPED overlapped = {};
-  overlapped.hEvent = CreateEvent(nullptr, false, false, nullptr);
+// lets other threads interrupt an io loop that is blocked in poll
+struct IoWaker {
+  SOCKET sock = INVALID_SOCKET;
+};
 
-  constexpr DWORD buf_size = 4096;
-  void *buf = malloc(buf_size);
+// most jobs one session holds at once, open or waiting to be opened
+constexpr u64 TRANSFER_BATCH_SIZE = 256;
+
+struct TransferPool {
+  std::vector<std::thread> threads;
+  std::vector<IoWaker> wakers; // one per thread
+  std::mutex mtx;
+  std::deque<TransferJob> queue;
+  std::unordered_set<std::string> busy; // remote paths being uploaded
+  std::vector<TransferResult> results;
+  UploadIndex index;
+  UploadJournal journal;
+  i32 active = 0;
+  i32 connected = 0;
+  bool quit = false;
+
+  // sessions are dialed by the connector thread and handed to io threads
+  // through spare. it keeps standby more than the io threads are missing,
+  // so a dropped session is replaced without waiting for a handshake
+  std::thread connector;
+  std::condition_variable connector_cv;
+  std::vector<Net> spare;
+  u32 missing = 0;
+  u32 standby = 0;
+  u32 dialing = 0;
+  u32 dial_failures = 0; // in a row, for the backoff
+  f64 redial_at = 0;
+  i32 reconnects = 0;
+
+  // copied from the config when the pool starts, read by the io threads
+  std::string host;
+  std::string user;
+  std::string priv_key;
+  u32 write_window = 0;
+};
 
-  bool ok = ReadDirectoryChangesW(dir, buf, buf_size, true,
-                                  FILE_NOTIFY_CHANGE_FILE_NAME |
-                                      FILE_NOTIFY_CHANGE_DIR_NAME |
-                                      FILE_NOTIFY_CHANGE_LAST_WRITE,
-                                  nullptr, &overlapped, nullptr);
-  if (!ok) {
-    error_message(L"ReadDirectoryChangesW failed");
-  }
+constexpr u64 WHEEL_SLOTS = 256;
+constexpr f64 WHEEL_TICK = 0.01;
 
-  watcher->dir = dir;
-  watcher->overlapped = overlapped;
-  watcher->buf = buf;
-  watcher->buf_size = buf_size;
-}
+struct QuietChange {
+  FileChange change; // the latest one
+  f64 deadline = 0;
+};
 
-static bool watcher_destroy(FileWatcher *watcher) {
-  if (!CloseHandle(watcher->overlapped.hEvent)) {
-    return false;
-  }
+// hashed timer wheel that holds changes back until their path goes quiet.
+// a slot lists the paths due on its tick, modulo the wheel size. a path
+// that changes again keeps its slot and is moved when the slot comes up
+struct TimerWheel {
+  std::vector<std::string> slots[WHEEL_SLOTS];
+  u64 tick = 0; // next tick to run
+  std::unordered_map<std::string, QuietChange> pending;
+};
 
-  if (!CloseHandle(watcher->dir)) {
-    return false;
-  }
+// runs the file watcher on its own thread. changes are turned into uploads
+// as soon as the os reports them, instead of once per frame
+struct WatchThread {
+  FileWatcher watcher;
+  std::thread thread;
+  std::atomic<bool> quit = false;
+  ChangeQueue uploads; // changes that started an upload, read by the ui
+  ChangeQueue rescanned; // changes found by rescan workers
+  std::vector<std::future<void>> rescans;
+  std::atomic<i32> overflows = 0;
+
+  TimerWheel quiet;
+  f64 quiet_period = 0;
+  std::atomic<i32> events = 0; // changes that reached the timer wheel
+  std::atomic<i32> settled = 0; // changes that came out of it
+
+  // copied when the thread starts
+  std::string local_dir;
+  std::string remote_dir;
+  TransferPool *transfers = nullptr;
 
-  free(watcher->buf);
+  bool running() const { return thread.joinable(); }
+};
 
-  *watcher = {};
-  return true;
-}
+struct LatencyStats {
+  f64 last = 0;
+  f64 max = 0;
+  f64 total = 0;
+  i32 count = 0;
+};
 
-static void watcher_poll(FileWatcher *watcher) {
-  watcher->changes.clear();
-  if (!watcher->running()) {
-    return;
-  }
+struct ReconcileFile {
+  u64 size = 0;
+  u32 mtime = 0;
+};
 
-  if (!watcher->overlapped.hEvent) {
-    return;
-  }
+enum class ReconcileState : i32 {
+  Idle,
+  Scanning,
+  Done,
+  Failed,
+};
 
-  DWORD wait = WaitForSingleObject(watcher->overlapped.hEvent, 0);
-  if (wait != WAIT_OBJECT_0) {
-    return;
+// compares both trees after connecting, so changes made while file-sink
+// wasn't running are uploaded too. the counters are read by the ui
+struct Reconcile {
+  std::thread thread;
+  std::atomic<bool> quit = false;
+  std::atomic<ReconcileState> state = ReconcileState::Idle;
+  std::atomic<i32> local_files = 0;
+  std::atomic<i32> remote_files = 0;
+  std::atomic<i32> queued = 0;
+  std::atomic<i32> skipped = 0; // remote directories that couldn't be read
+};
+
+// directories a walk reads at once on each connection
+constexpr i32 REMOTE_WALK_OPEN_DIRS = 64;
+
+// connections a reconcile walks the remote tree over
+constexpr u32 RECONCILE_SESSIONS = 2;
+
+// walks a remote tree breadth first. directories found wait in a queue and
+// a fixed set of workers per connection takes them from it, so many
+// OPENDIR and READDIR requests are in flight at once on every connection
+struct RemoteWalk {
+  std::string root;
+  std::deque<std::string> dirs; // relative paths waiting to be read
+  std::vector<std::pair<SftpPipe *, std::coroutine_handle<>>> idle;
+  i32 reading = 0; // directories being read
+  i32 pending = 0; // workers still running
+  bool ok = true;
+
+  std::unordered_map<std::string, ReconcileFile> files; // relative paths
+  std::atomic<i32> *found = nullptr; // files seen so far, for progress
+  std::atomic<i32> *skipped = nullptr; // directories that couldn't be read
+};
+
+// parks a worker until a directory is queued or the walk ends. it's woken
+// through its pipe's yielded list, on the next run of that pipe
+struct RemoteWalkIdle {
+  RemoteWalk *walk;
+  SftpPipe *pipe;
+
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> h) {
+    walk->idle.push_back({pipe, h});
   }
+  void await_resume() {}
+};
+
+// an entry an upload put into a remote directory
+struct RemotePatch {
+  std::string name;
+  FileKind kind = FileKind::File;
+  u64 size = 0;
+  u32 mtime = 0;
+};
+
+// remote directories are listed by a thread that owns the ui's connection
+// once it's up. the ui asks for a directory and takes the entries in
+// batches as the replies arrive, so a large directory shows up right away
+// and fills in while it's read. asking for another directory cancels the
+// one being read, and the ui never waits on the connection. the thread
+// keeps an idle connection alive and dials it again when it drops
+struct RemoteListing {
+  std::thread thread;
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::atomic<bool> quit = false;
+  std::atomic<u32> asked = 0; // directories asked for so far
+  std::string wanted;         // the last one, written by the ui
+  u32 reading = 0;            // the request incoming is for
+  u32 finished = 0;           // the last request the thread is done with
+  bool finished_ok = false;
+  FileList incoming; // read but not merged into the panel yet
+
+  // copied from the config when the thread starts, for redials
+  std::string host;
+  std::string user;
+  std::string priv_key;
 
-  DWORD bytes = 0;
-  GetOverlappedResult(watcher->dir, &watcher->overlapped, &bytes, false);
+  // used by the listing thread only
+  u32 dial_failures = 0; // in a row, for the backoff
+  f64 redial_at = 0;
+
+  // used by the coroutines on the listing thread only
+  u32 job = 0;
+  std::string path;
+  std::string handle;
+  i32 pending = 0;
+  i32 readers = 0;
+  bool failed = false;
+
+  // used by the ui only
+  u32 shown = 0;   // the request the panel shows entries of
+  u32 settled = 0; // the last request merged in completely
+  bool revalidating = false; // the panel shows the cached entries
+  FileList fresh;            // entries read while revalidating
+  // uploads into the directory being read. the server may have listed
+  // their entries before they were written
+  std::vector<RemotePatch> patches;
+};
 
-  auto info = (FILE_NOTIFY_INFORMATION *)watcher->buf;
+// directory entries the remote listing cache holds at most
+constexpr u64 REMOTE_CACHE_ENTRIES = 1 << 20;
 
-  char filename[MAX_PATH] = {};
+struct CachedDir {
+  FileList list;
+  u64 used = 0;
+};
 
-  while (true) {
-    if (info->Action != 0) {
-      i32 wlen = info->FileNameLength / sizeof(wchar_t);
+// remote directories listed before, by path. a cached directory is shown
+// right away while it's listed again. the least recently shown ones are
+// dropped once the cache is full
+struct RemoteCache {
+  std::unordered_map<std::string, CachedDir> dirs;
+  u64 entries = 0;
+  u64 clock = 0;
+};
 
-      errno_t err = wcstombs_s(nullptr, filename, array_size(filename),
-                               info->FileName, wlen);
-      if (!err) {
-        FileChange change = {};
-        change.type = info->Action;
-        change.filename = filename;
-        watcher->changes.push_back(std::move(change));
-      }
-    }
+// READDIR requests kept outstanding on one directory handle. the server
+// answers them in order, each with the next batch of names
+constexpr i32 LISTING_READDIRS = 8;
+
+// the rows of a file panel that pass its filter. they're only found again
+// when the filter or the listing changes, and only visible rows are drawn
+struct FileView {
+  ImGuiTextFilter filter;
+  std::vector<u32> rows; // rows of the listing, in its order
+  u32 version = 0;       // of the listing the rows were found for
+  std::string query;     // filter text the rows were found for
+  MatchIndex index;
+  u32 indexed = 0; // version of the listing in the index
+};
 
-    if (info->NextEntryOffset) {
-      char *next_entry = &((char *)info)[info->NextEntryOffset];
-      info = (FILE_NOTIFY_INFORMATION *)next_entry;
-    } else {
-      break;
-    }
-  }
+enum class FinderState : i32 {
+  Idle,
+  Indexing,
+  Ready,
+  Failed,
+};
+
+// paths the go to file palette shows at most
+constexpr u32 FINDER_RESULTS = 100;
+
+// finds files anywhere below the local dir by parts of their path. the
+// tree is scanned and indexed once, then every query typed in the palette
+// is answered on the finder's thread. a query still running when the next
+// one is typed is dropped
+struct FileFinder {
+  std::thread thread;
+  std::atomic<FinderState> state = FinderState::Idle;
+  std::atomic<bool> quit = false;
+  std::atomic<bool> cancel = false;
+  std::atomic<i32> found = 0; // files seen while scanning
+  std::string root;
+
+  // written by the thread until the state is Ready
+  std::vector<std::string> paths; // relative to the root, sorted
+  FinderIndex index;
+  FinderCache cache;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::string query;
+  u32 asked = 0;    // queries typed so far
+  u32 answered = 0; // the query the hits are for
+  std::vector<FinderHit> hits;
+  f64 seconds = 0;
+
+  // used by the ui only
+  std::string input;
+  std::vector<FinderHit> shown;
+  u32 shown_for = 0;
+  i32 selected = 0;
+};
+
+struct ServerDial {
+  std::optional<Net> net;
+  const wchar_t *error = nullptr;
+};
+
+struct App {
+  GLFWwindow *window = nullptr;
+  bool ran_first_update = false;
+  std::future<ServerDial> dial; // the connection being made
+  bool show_demo = false;
+  FileList local_working_dir;
+  FileList remote_working_dir;
+  u32 local_version = 1; // bumped whenever the listing changes
+  u32 remote_version = 1;
+  FileView local_view;
+  FileView remote_view;
+  std::deque<std::string> watcher_log; // the last WATCHER_LOG_LINES
+  LatencyStats upload_latency;
+  Reconcile reconcile;
+  RemoteListing remote_listing;
+  RemoteCache remote_cache;
+  FileFinder finder;
+};
+
+static void error_message(const wchar_t *msg) {
+#ifdef _WIN32
+  MessageBox(nullptr, msg, nullptr, 0);
+#else
+  fprintf(stderr, "%ls\n", msg);
+#endif
+}
+
+// sessions send a keepalive after this many idle seconds. one that waits
+// on replies and hears nothing for SESSION_STALL seconds is given up on
+constexpr u32 KEEPALIVE_INTERVAL = 5;
+constexpr f64 SESSION_STALL = 10;
+constexpr i32 CONNECT_TIMEOUT_MS = 5000;
+constexpr i32 SSH_TIMEOUT_MS = 10000;
 
-  ReadDirectoryChangesW(watcher->dir, watcher->buf, watcher->buf_size, true,
-                        FILE_NOTIFY_CHANGE_FILE_NAME |
-                            FILE_NOTIFY_CHANGE_DIR_NAME |
-                            FILE_NOTIFY_CHANGE_LAST_WRITE,
-                        nullptr, &watcher->overlapped, nullptr);
+// delay before redialing after failed attempts, doubling up to the max
+constexpr f64 RECONNECT_MIN = 0.1;
+constexpr f64 RECONNECT_MAX = 5;
+
+static f64 now_seconds() {
+  using namespace std::chrono;
+  return duration<f64>(steady_clock::now().time_since_epoch()).count();
 }
 
 static std::optional<std::string> read_entire_file(const char *path) {
@@ -210,8 +609,12 @@ static bool read_config(Config *config) {
   while (std::getline(iss, line)) {
     char key[256] = {};
     char value[512] = {};
+#ifdef _WIN32
     i32 res = sscanf_s(line.data(), "%[^=]=%[^\n]", key, (u32)array_size(key),
                        value, (u32)array_size(value));
+#else
+    i32 res = sscanf(line.data(), "%255[^=]=%511[^\n]", key, value);
+#endif
     if (res == EOF) {
       break;
     }
@@ -226,6 +629,16 @@ static bool read_config(Config *config) {
       config->local_dir = value;
     } else if (strcmp(key, "remote_dir") == 0) {
       config->remote_dir = value;
+    } else if (strcmp(key, "write_window") == 0) {
+      config->write_window = (u32)strtoul(value, nullptr, 10);
+    } else if (strcmp(key, "transfer_sessions") == 0) {
+      config->transfer_sessions = (u32)strtoul(value, nullptr, 10);
+    } else if (strcmp(key, "transfer_threads") == 0) {
+      config->transfer_threads = (u32)strtoul(value, nullptr, 10);
+    } else if (strcmp(key, "standby_sessions") == 0) {
+      config->standby_sessions = (u32)strtoul(value, nullptr, 10);
+    } else if (strcmp(key, "quiet_ms") == 0) {
+      config->quiet_ms = (u32)strtoul(value, nullptr, 10);
     }
   }
 
@@ -253,8 +666,14 @@ static void write_config(const Config &config) {
   fprintf(fp, "priv_key=%s\n", config.priv_key.data());
   fprintf(fp, "local_dir=%s\n", config.local_dir.data());
   fprintf(fp, "remote_dir=%s\n", config.remote_dir.data());
+  fprintf(fp, "write_window=%u\n", config.write_window);
+  fprintf(fp, "transfer_sessions=%u\n", config.transfer_sessions);
+  fprintf(fp, "transfer_threads=%u\n", config.transfer_threads);
+  fprintf(fp, "standby_sessions=%u\n", config.standby_sessions);
+  fprintf(fp, "quiet_ms=%u\n", config.quiet_ms);
 }
 
+#ifdef _WIN32
 static const char *open_dialog(GLFWwindow *window, const wchar_t *filter) {
   static char s_result[MAX_PATH];
 
@@ -280,264 +699,2969 @@ static const char *open_dialog(GLFWwindow *window, const wchar_t *filter) {
     return nullptr;
   }
 
-  return s_result;
-}
+  return s_result;
+}
+
+static const char *open_directory_dialog(GLFWwindow *window) {
+  static char s_result[MAX_PATH];
+
+  IFileOpenDialog *dialog;
+  HRESULT result = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
+                                    IID_IFileOpenDialog, (void **)&dialog);
+  if (!SUCCEEDED(result)) {
+    return nullptr;
+  }
+  result = dialog->SetOptions(FOS_PICKFOLDERS | FOS_FORCEFILESYSTEM |
+                              FOS_PATHMUSTEXIST | FOS_FILEMUSTEXIST |
+                              FOS_NOCHANGEDIR);
+  defer(dialog->Release());
+  if (!SUCCEEDED(result)) {
+    return nullptr;
+  }
+
+  result = dialog->Show(glfwGetWin32Window(window));
+  if (!SUCCEEDED(result)) {
+    return nullptr;
+  }
+
+  IShellItem *item;
+  result = dialog->GetResult(&item);
+  if (!SUCCEEDED(result)) {
+    return nullptr;
+  }
+
+  wchar_t *path;
+  result = item->GetDisplayName(SIGDN_FILESYSPATH, &path);
+  defer(item->Release());
+
+  if (!SUCCEEDED(result)) {
+    return nullptr;
+  }
+
+  defer(CoTaskMemFree(path));
+
+  errno_t err =
+      wcstombs_s(nullptr, s_result, array_size(s_result), path, _TRUNCATE);
+  if (err) {
+    return nullptr;
+  }
+
+  return s_result;
+}
+#else
+// there's no native file dialog on linux, zenity is installed with most
+// desktops
+static const char *zenity_dialog(const char *args) {
+  static char s_result[MAX_PATH];
+
+  char cmd[256];
+  snprintf(cmd, array_size(cmd), "zenity --file-selection %s 2>/dev/null",
+           args);
+
+  FILE *fp = popen(cmd, "r");
+  if (!fp) {
+    return nullptr;
+  }
+
+  char *line = fgets(s_result, array_size(s_result), fp);
+  i32 status = pclose(fp);
+  if (!line || status != 0) {
+    return nullptr;
+  }
+
+  s_result[strcspn(s_result, "\n")] = 0;
+  return s_result;
+}
+
+static const char *open_dialog(GLFWwindow *, const wchar_t *) {
+  return zenity_dialog("");
+}
+
+static const char *open_directory_dialog(GLFWwindow *) {
+  return zenity_dialog("--directory");
+}
+#endif
+
+static void put_u8(std::string *buf, u8 n) { buf->push_back((char)n); }
+
+static void put_u32(std::string *buf, u32 n) {
+  char bytes[4] = {(char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n};
+  buf->append(bytes, sizeof(bytes));
+}
+
+static void put_u64(std::string *buf, u64 n) {
+  put_u32(buf, (u32)(n >> 32));
+  put_u32(buf, (u32)n);
+}
+
+static void put_str(std::string *buf, const char *str, u64 len) {
+  put_u32(buf, (u32)len);
+  buf->append(str, len);
+}
+
+static void put_attrs(std::string *buf, const SftpAttrs &attrs) {
+  put_u32(buf, attrs.flags);
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
+    put_u64(buf, attrs.size);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+    put_u32(buf, attrs.permissions);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+    put_u32(buf, attrs.atime);
+    put_u32(buf, attrs.mtime);
+  }
+}
+
+static u32 get_u32(const char *bytes) {
+  auto b = (const u8 *)bytes;
+  return ((u32)b[0] << 24) | ((u32)b[1] << 16) | ((u32)b[2] << 8) | b[3];
+}
+
+// bounds checked cursor over a reply body
+struct SftpReader {
+  const char *p = nullptr;
+  const char *end = nullptr;
+  bool ok = true;
+};
+
+static u32 read_u32(SftpReader *r) {
+  if (r->end - r->p < 4) {
+    r->ok = false;
+    return 0;
+  }
+  u32 n = get_u32(r->p);
+  r->p += 4;
+  return n;
+}
+
+static u64 read_u64(SftpReader *r) {
+  u64 hi = read_u32(r);
+  u64 lo = read_u32(r);
+  return (hi << 32) | lo;
+}
+
+static std::string_view read_str(SftpReader *r) {
+  u32 len = read_u32(r);
+  if (!r->ok || (u64)(r->end - r->p) < len) {
+    r->ok = false;
+    return {};
+  }
+  std::string_view str(r->p, len);
+  r->p += len;
+  return str;
+}
+
+static SftpAttrs read_attrs(SftpReader *r) {
+  SftpAttrs attrs;
+  attrs.flags = read_u32(r);
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
+    attrs.size = read_u64(r);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+    read_u32(r);
+    read_u32(r);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+    attrs.permissions = read_u32(r);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+    attrs.atime = read_u32(r);
+    attrs.mtime = read_u32(r);
+  }
+  if (attrs.flags & LIBSSH2_SFTP_ATTR_EXTENDED) {
+    u32 count = read_u32(r);
+    for (u32 i = 0; i < count && r->ok; i++) {
+      read_str(r);
+      read_str(r);
+    }
+  }
+  return attrs;
+}
+
+// appends the packet header and returns the offset of the packet so the
+// length can be patched by sftp_end
+static u64 sftp_begin(SftpPipe *pipe, SftpType type, u32 *id) {
+  u64 start = pipe->out.size();
+  put_u32(&pipe->out, 0);
+  put_u8(&pipe->out, (u8)type);
+  *id = pipe->next_id++;
+  put_u32(&pipe->out, *id);
+
+  f64 now = now_seconds();
+  if (pipe->sent.empty()) {
+    pipe->heard_at = now;
+  }
+  pipe->sent[*id].at = now;
+  return start;
+}
+
+static void sftp_end(SftpPipe *pipe, u64 start) {
+  u32 len = (u32)(pipe->out.size() - start - 4);
+  char *p = &pipe->out[start];
+  p[0] = (char)(len >> 24);
+  p[1] = (char)(len >> 16);
+  p[2] = (char)(len >> 8);
+  p[3] = (char)len;
+}
+
+// requests that only carry a path or a handle
+static u32 sftp_send_str(SftpPipe *pipe, SftpType type,
+                         const std::string &str) {
+  u32 id = 0;
+  u64 start = sftp_begin(pipe, type, &id);
+  put_str(&pipe->out, str.data(), str.size());
+  sftp_end(pipe, start);
+  return id;
+}
+
+static u32 sftp_send_attrs(SftpPipe *pipe, SftpType type,
+                           const std::string &path, const SftpAttrs &attrs) {
+  u32 id = 0;
+  u64 start = sftp_begin(pipe, type, &id);
+  put_str(&pipe->out, path.data(), path.size());
+  put_attrs(&pipe->out, attrs);
+  sftp_end(pipe, start);
+  return id;
+}
+
+static u32 sftp_send_open(SftpPipe *pipe, const std::string &path, u32 pflags,
+                          u32 permissions) {
+  u32 id = 0;
+  u64 start = sftp_begin(pipe, SftpType::Open, &id);
+  put_str(&pipe->out, path.data(), path.size());
+  put_u32(&pipe->out, pflags);
+  put_u32(&pipe->out, LIBSSH2_SFTP_ATTR_PERMISSIONS);
+  put_u32(&pipe->out, permissions);
+  sftp_end(pipe, start);
+  return id;
+}
+
+static u32 sftp_send_write(SftpPipe *pipe, const std::string &handle,
+                           u64 offset, const char *data, u32 len) {
+  u32 id = 0;
+  u64 start = sftp_begin(pipe, SftpType::Write, &id);
+  put_str(&pipe->out, handle.data(), handle.size());
+  put_u64(&pipe->out, offset);
+  put_str(&pipe->out, data, len);
+  sftp_end(pipe, start);
+
+  if (pipe->inflight_bytes == 0) {
+    pipe->busy_since = pipe->sent[id].at;
+    pipe->acked = 0;
+  }
+  pipe->sent[id].write_len = len;
+  pipe->inflight_bytes += len;
+  return id;
+}
+
+static void sftp_sample_rtt(SftpPipe *pipe, f64 rtt) {
+  if (pipe->min_rtt == 0 || rtt < pipe->min_rtt) {
+    pipe->min_rtt = rtt;
+  }
+}
+
+static void sftp_sample_throughput(SftpPipe *pipe, f64 bytes_per_sec) {
+  if (pipe->throughput == 0) {
+    pipe->throughput = bytes_per_sec;
+  } else {
+    pipe->throughput = pipe->throughput * 0.75 + bytes_per_sec * 0.25;
+  }
+}
+
+constexpr u32 SFTP_WRITE_SIZE = 32 * 1024;
+constexpr u64 SFTP_MIN_WINDOW = 256 * 1024;
+constexpr u64 SFTP_MAX_WINDOW = 32 * 1024 * 1024;
+
+// twice the bandwidth-delay product. throughput can't exceed window / rtt,
+// so while the link isn't saturated the window keeps doubling
+static u64 sftp_write_window(SftpPipe *pipe) {
+  if (pipe->write_window != 0) {
+    return (u64)pipe->write_window * 1024;
+  }
+
+  u64 window = (u64)(pipe->throughput * pipe->min_rtt * 2);
+  return std::clamp(window, SFTP_MIN_WINDOW, SFTP_MAX_WINDOW);
+}
+
+static void sftp_sample_reply(SftpPipe *pipe, u32 id) {
+  auto it = pipe->sent.find(id);
+  if (it == pipe->sent.end()) {
+    return;
+  }
+
+  f64 now = now_seconds();
+  sftp_sample_rtt(pipe, now - it->second.at);
+
+  if (u32 len = it->second.write_len) {
+    pipe->inflight_bytes -= len;
+    pipe->acked += len;
+
+    // only trust the rate once a full window has been acknowledged
+    if (pipe->acked >= sftp_write_window(pipe) && now > pipe->busy_since) {
+      sftp_sample_throughput(pipe, pipe->acked / (now - pipe->busy_since));
+    }
+  }
+
+  pipe->sent.erase(it);
+}
+
+static i32 sftp_flush(SftpPipe *pipe) {
+  while (pipe->out_pos < pipe->out.size()) {
+    i64 n = libssh2_channel_write(pipe->channel, &pipe->out[pipe->out_pos],
+                                  pipe->out.size() - pipe->out_pos);
+    if (n < 0) {
+      return (i32)n;
+    }
+    pipe->out_pos += n;
+  }
+
+  pipe->out.clear();
+  pipe->out_pos = 0;
+  return 0;
+}
+
+// reads what the channel has and moves every complete packet into replies.
+// returns the number of bytes read
+static i32 sftp_pump(SftpPipe *pipe) {
+  constexpr u64 read_size = 64 * 1024;
+
+  u64 len = pipe->in.size();
+  pipe->in.resize(len + read_size);
+  i64 n = libssh2_channel_read(pipe->channel, &pipe->in[len], read_size);
+  pipe->in.resize(len + (n > 0 ? n : 0));
+  if (n < 0) {
+    return (i32)n;
+  }
+  if (n > 0) {
+    pipe->heard_at = now_seconds();
+  }
+  if (n == 0 && libssh2_channel_eof(pipe->channel)) {
+    return LIBSSH2_ERROR_CHANNEL_CLOSED;
+  }
+
+  u64 pos = 0;
+  while (pipe->in.size() - pos >= 9) {
+    const char *packet = &pipe->in[pos];
+    u32 packet_len = get_u32(packet);
+    if (packet_len < 5) {
+      return LIBSSH2_ERROR_SFTP_PROTOCOL;
+    }
+    if (pipe->in.size() - pos - 4 < packet_len) {
+      break;
+    }
+
+    SftpReply reply;
+    reply.type = (SftpType)packet[4];
+    reply.body.assign(packet + 9, packet_len - 5);
+    if (reply.type == SftpType::Status && reply.body.size() >= 4) {
+      reply.status = get_u32(reply.body.data());
+    }
+
+    // VERSION carries the version number where other replies have the id
+    u32 id = reply.type == SftpType::Version ? 0 : get_u32(packet + 5);
+    sftp_sample_reply(pipe, id);
+    pipe->replies[id] = std::move(reply);
+    pos += 4 + packet_len;
+  }
+  pipe->in.erase(0, pos);
+
+  return (i32)n;
+}
+
+static std::optional<SftpReply> sftp_wait(SftpPipe *pipe, u32 id) {
+  if (sftp_flush(pipe) < 0) {
+    return std::nullopt;
+  }
+
+  while (true) {
+    auto it = pipe->replies.find(id);
+    if (it != pipe->replies.end()) {
+      SftpReply reply = std::move(it->second);
+      pipe->replies.erase(it);
+      return reply;
+    }
+
+    if (sftp_pump(pipe) < 0) {
+      return std::nullopt;
+    }
+  }
+}
+
+static SftpPipe *sftp_pipe_open(LIBSSH2_SESSION *session) {
+  LIBSSH2_CHANNEL *channel = libssh2_channel_open_session(session);
+  if (!channel) {
+    return nullptr;
+  }
+
+  if (libssh2_channel_subsystem(channel, "sftp")) {
+    libssh2_channel_free(channel);
+    return nullptr;
+  }
+
+  SftpPipe *pipe = new SftpPipe;
+  pipe->channel = channel;
+
+  // INIT is the only request without a request id
+  put_u32(&pipe->out, 5);
+  put_u8(&pipe->out, (u8)SftpType::Init);
+  put_u32(&pipe->out, LIBSSH2_SFTP_VERSION);
+
+  auto version = sftp_wait(pipe, 0);
+  if (!version || version->type != SftpType::Version) {
+    libssh2_channel_free(channel);
+    delete pipe;
+    return nullptr;
+  }
+
+  return pipe;
+}
+
+static void sftp_pipe_close(SftpPipe *pipe) {
+  libssh2_channel_close(pipe->channel);
+  libssh2_channel_free(pipe->channel);
+  delete pipe;
+}
+
+// awaitable reply to a request that was sent when the awaitable was made.
+// several can be made before awaiting any of them to pipeline requests
+template <class T> struct SftpCall {
+  SftpPipe *pipe = nullptr;
+  u32 id = 0;
+  T (*parse)(SftpReply *reply) = nullptr; // reply is null if the pipe failed
+
+  bool await_ready() { return pipe->failed || pipe->replies.count(id); }
+  void await_suspend(std::coroutine_handle<> h) { pipe->waiters[id] = h; }
+
+  T await_resume() {
+    auto it = pipe->replies.find(id);
+    if (it == pipe->replies.end()) {
+      return parse(nullptr);
+    }
+
+    SftpReply reply = std::move(it->second);
+    pipe->replies.erase(it);
+    return parse(&reply);
+  }
+};
+
+// suspends until the write window has room
+struct SftpWindow {
+  SftpPipe *pipe = nullptr;
+
+  bool await_ready() {
+    return pipe->failed || pipe->inflight_bytes < sftp_write_window(pipe);
+  }
+  void await_suspend(std::coroutine_handle<> h) {
+    pipe->window_waiters.push_back(h);
+  }
+  void await_resume() {}
+};
+
+// suspends until the next time the pipe is run
+struct SftpYield {
+  SftpPipe *pipe = nullptr;
+
+  bool await_ready() { return pipe->failed; }
+  void await_suspend(std::coroutine_handle<> h) { pipe->yielded.push_back(h); }
+  void await_resume() {}
+};
+
+static bool parse_status(SftpReply *reply) {
+  return reply && reply->type == SftpType::Status &&
+         reply->status == LIBSSH2_FX_OK;
+}
+
+static std::optional<std::string> parse_handle(SftpReply *reply) {
+  if (!reply || reply->type != SftpType::Handle) {
+    return std::nullopt;
+  }
+
+  SftpReader r = {reply->body.data(), reply->body.data() + reply->body.size()};
+  std::string_view handle = read_str(&r);
+  if (!r.ok) {
+    return std::nullopt;
+  }
+  return std::string(handle);
+}
+
+static std::optional<SftpAttrs> parse_attrs(SftpReply *reply) {
+  if (!reply || reply->type != SftpType::Attrs) {
+    return std::nullopt;
+  }
+
+  SftpReader r = {reply->body.data(), reply->body.data() + reply->body.size()};
+  SftpAttrs attrs = read_attrs(&r);
+  if (!r.ok) {
+    return std::nullopt;
+  }
+  return attrs;
+}
+
+// an empty list means the end of the directory was reached
+static std::optional<std::vector<SftpName>> parse_names(SftpReply *reply) {
+  if (reply && reply->type == SftpType::Status &&
+      reply->status == LIBSSH2_FX_EOF) {
+    return std::vector<SftpName>();
+  }
+
+  if (!reply || reply->type != SftpType::Name) {
+    return std::nullopt;
+  }
+
+  SftpReader r = {reply->body.data(), reply->body.data() + reply->body.size()};
+  u32 count = read_u32(&r);
+
+  std::vector<SftpName> names;
+  names.reserve(std::min<u32>(count, 4096));
+  for (u32 i = 0; i < count && r.ok; i++) {
+    SftpName name;
+    name.name = read_str(&r);
+    read_str(&r); // longname
+    name.attrs = read_attrs(&r);
+    names.push_back(std::move(name));
+  }
+
+  if (!r.ok) {
+    return std::nullopt;
+  }
+  return names;
+}
+
+static SftpCall<std::optional<std::string>>
+sftp_open(SftpPipe *pipe, const std::string &path, u32 pflags,
+          u32 permissions) {
+  return {pipe, sftp_send_open(pipe, path, pflags, permissions), parse_handle};
+}
+
+static SftpCall<bool> sftp_write(SftpPipe *pipe, const std::string &handle,
+                                 u64 offset, const char *data, u32 len) {
+  return {pipe, sftp_send_write(pipe, handle, offset, data, len),
+          parse_status};
+}
+
+static SftpCall<bool> sftp_close(SftpPipe *pipe, const std::string &handle) {
+  return {pipe, sftp_send_str(pipe, SftpType::Close, handle), parse_status};
+}
+
+static SftpCall<std::optional<std::string>>
+sftp_opendir(SftpPipe *pipe, const std::string &path) {
+  return {pipe, sftp_send_str(pipe, SftpType::Opendir, path), parse_handle};
+}
+
+static SftpCall<std::optional<std::vector<SftpName>>>
+sftp_readdir(SftpPipe *pipe, const std::string &handle) {
+  return {pipe, sftp_send_str(pipe, SftpType::Readdir, handle), parse_names};
+}
+
+static SftpCall<std::optional<SftpAttrs>> sftp_stat(SftpPipe *pipe,
+                                                    const std::string &path) {
+  return {pipe, sftp_send_str(pipe, SftpType::Stat, path), parse_attrs};
+}
+
+static SftpCall<bool> sftp_setstat(SftpPipe *pipe, const std::string &path,
+                                   const SftpAttrs &attrs) {
+  return {pipe, sftp_send_attrs(pipe, SftpType::Setstat, path, attrs),
+          parse_status};
+}
+
+static SftpCall<bool> sftp_mkdir(SftpPipe *pipe, const std::string &path) {
+  SftpAttrs attrs;
+  attrs.flags = LIBSSH2_SFTP_ATTR_PERMISSIONS;
+  attrs.permissions = LIBSSH2_SFTP_S_IRWXU | LIBSSH2_SFTP_S_IRGRP |
+                      LIBSSH2_SFTP_S_IXGRP | LIBSSH2_SFTP_S_IROTH |
+                      LIBSSH2_SFTP_S_IXOTH;
+  return {pipe, sftp_send_attrs(pipe, SftpType::Mkdir, path, attrs),
+          parse_status};
+}
+
+static Task<bool> sftp_mkdir_p(SftpPipe *pipe, std::string path) {
+  if (path.empty() || path == "/" || path == ".") {
+    co_return true;
+  }
+
+  if (co_await sftp_mkdir(pipe, path)) {
+    co_return true;
+  }
+
+  // sftp v3 has no error code for a directory that already exists
+  auto attrs = co_await sftp_stat(pipe, path);
+  if (attrs) {
+    co_return (attrs->permissions & LIBSSH2_SFTP_S_IFMT) ==
+        LIBSSH2_SFTP_S_IFDIR;
+  }
+
+  u64 slash = path.find_last_of('/');
+  if (slash == std::string::npos || slash == 0) {
+    co_return false;
+  }
+
+  if (!co_await sftp_mkdir_p(pipe, path.substr(0, slash))) {
+    co_return false;
+  }
+
+  co_return co_await sftp_mkdir(pipe, path);
+}
+
+// resumes every suspended coroutine with a failure result
+static i32 sftp_fail(SftpPipe *pipe, i32 rc) {
+  pipe->failed = true;
+
+  std::vector<std::coroutine_handle<>> ready;
+  for (auto &[id, h] : pipe->waiters) {
+    ready.push_back(h);
+  }
+  for (auto h : pipe->window_waiters) {
+    ready.push_back(h);
+  }
+  for (auto h : pipe->yielded) {
+    ready.push_back(h);
+  }
+  pipe->waiters.clear();
+  pipe->window_waiters.clear();
+  pipe->yielded.clear();
+
+  for (auto h : ready) {
+    h.resume();
+  }
+
+  return rc;
+}
+
+// the scheduler for coroutines using the pipe. sends queued requests, reads
+// replies and resumes whoever waits on them until nothing else can happen
+// without blocking. returns a libssh2 error if the connection failed
+static i32 sftp_run(SftpPipe *pipe) {
+  if (pipe->failed) {
+    return LIBSSH2_ERROR_CHANNEL_CLOSED;
+  }
+
+  std::vector<std::coroutine_handle<>> ready;
+  ready.swap(pipe->yielded);
+  for (auto h : ready) {
+    h.resume();
+  }
+
+  while (true) {
+    i32 rc = sftp_flush(pipe);
+    if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
+      return sftp_fail(pipe, rc);
+    }
+
+    // drain the channel completely. libssh2 may already hold data that
+    // was read off the socket, and poll wouldn't report it
+    do {
+      rc = sftp_pump(pipe);
+    } while (rc > 0);
+    if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
+      return sftp_fail(pipe, rc);
+    }
+
+    ready.clear();
+    for (auto it = pipe->waiters.begin(); it != pipe->waiters.end();) {
+      if (pipe->replies.count(it->first)) {
+        ready.push_back(it->second);
+        it = pipe->waiters.erase(it);
+      } else {
+        it++;
+      }
+    }
+
+    for (auto h : ready) {
+      h.resume();
+    }
+
+    bool progress = !ready.empty();
+    while (!pipe->window_waiters.empty() &&
+           pipe->inflight_bytes < sftp_write_window(pipe)) {
+      auto h = pipe->window_waiters.front();
+      pipe->window_waiters.pop_front();
+      h.resume();
+      progress = true;
+    }
+
+    if (!progress) {
+      return 0;
+    }
+  }
+}
+
+static void server_disconnect(Net *net) {
+  if (net->session) {
+    libssh2_session_set_blocking(net->session, 1);
+  }
+
+  if (net->pipe) {
+    sftp_pipe_close(net->pipe);
+  }
+
+  if (net->sftp) {
+    libssh2_sftp_shutdown(net->sftp);
+  }
+
+  if (net->session) {
+    libssh2_session_disconnect(net->session, "Normal Shutdown");
+    libssh2_session_free(net->session);
+  }
+
+  if (net->sock) {
+    // fails on a link that already dropped, which is fine
+    shutdown(net->sock, SD_BOTH);
+
+    if (closesocket(net->sock)) {
+      error_message(L"failed to close socket");
+    }
+  }
+
+  net->pipe = nullptr;
+  net->sftp = nullptr;
+  net->session = nullptr;
+  net->sock = 0;
+}
+
+// tcp connect with a timeout. a blocking connect to an unreachable host
+// only gives up after the kernel's syn retries, which can take minutes
+static bool connect_timeout(SOCKET sock, const sockaddr_in &sin,
+                            i32 timeout_ms) {
+#ifdef _WIN32
+  u_long nonblocking = 1;
+  ioctlsocket(sock, FIONBIO, &nonblocking);
+#else
+  i32 flags = fcntl(sock, F_GETFL);
+  fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+#endif
+
+  bool ok = connect(sock, (sockaddr *)&sin, sizeof(sin)) == 0;
+  if (!ok) {
+#ifdef _WIN32
+    bool pending = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    bool pending = errno == EINPROGRESS;
+#endif
+
+    WSAPOLLFD fd = {};
+    fd.fd = sock;
+    fd.events = POLLOUT;
+    if (pending && WSAPoll(&fd, 1, timeout_ms) == 1) {
+      i32 err = 0;
+      socklen_t len = sizeof(err);
+      ok = getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) == 0 &&
+           err == 0;
+    }
+  }
+
+#ifdef _WIN32
+  nonblocking = 0;
+  ioctlsocket(sock, FIONBIO, &nonblocking);
+#else
+  fcntl(sock, F_SETFL, flags);
+#endif
+  return ok;
+}
+
+// connects and authenticates without reporting errors, for reconnects in
+// the background. on failure error says what went wrong
+static std::optional<Net> server_dial(const char *host, const char *user,
+                                      const char *priv_key,
+                                      const wchar_t **error) {
+  Net net;
+  auto fail = [&](const wchar_t *msg) -> std::optional<Net> {
+    if (error) {
+      *error = msg;
+    }
+    server_disconnect(&net);
+    return std::nullopt;
+  };
+
+  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock == INVALID_SOCKET) {
+    return fail(L"cannot create socket");
+  }
+  net.sock = sock;
+
+  sockaddr_in sin = {};
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(22);
+
+  in_addr addr = {};
+  if (strcmp(host, "localhost") == 0) {
+    inet_pton(AF_INET, "127.0.0.1", &addr);
+  } else {
+    inet_pton(AF_INET, host, &addr);
+  }
+
+  sin.sin_addr = addr;
+
+  if (!connect_timeout(sock, sin, CONNECT_TIMEOUT_MS)) {
+    return fail(L"cannot connect");
+  }
+
+  net.session = libssh2_session_init();
+  if (!net.session) {
+    return fail(L"cannot create session");
+  }
+
+  libssh2_session_set_blocking(net.session, 1);
+  libssh2_session_set_timeout(net.session, SSH_TIMEOUT_MS);
+  if (libssh2_session_handshake(net.session, sock)) {
+    return fail(L"cannot establish ssh session");
+  }
+
+  auto userauthlist =
+      libssh2_userauth_list(net.session, user, (u32)strlen(user));
+
+  if (!userauthlist || !strstr(userauthlist, "publickey")) {
+    return fail(L"server doesn't support publickey auth");
+  }
+
+  if (libssh2_userauth_publickey_fromfile(net.session, user, nullptr,
+                                          priv_key, nullptr)) {
+    return fail(L"authentication failed");
+  }
+
+  net.sftp = libssh2_sftp_init(net.session);
+  if (!net.sftp) {
+    return fail(L"cannot create sftp session");
+  }
+
+  net.pipe = sftp_pipe_open(net.session);
+  if (!net.pipe) {
+    return fail(L"cannot open sftp channel");
+  }
+
+  // the server answers keepalives, so an idle link keeps traffic flowing
+  // and a dead one fails its sends
+  libssh2_keepalive_config(net.session, 1, KEEPALIVE_INTERVAL);
+  return net;
+}
+
+// run through std::async, so the handshake doesn't hold up frames
+static ServerDial server_dial_config(Config config) {
+  ServerDial d;
+  d.net = server_dial(config.host.data(), config.user.data(),
+                      config.priv_key.data(), &d.error);
+  return d;
+}
+
+static void change_local_dir(App *app, Config *config,
+                             const std::string &path) {
+  ScanTree tree;
+  ScanOptions opts;
+  opts.recursive = false;
+  if (!scan_tree(path, &tree, opts)) {
+    error_message(L"failed to read local dir");
+    return;
+  }
+
+  config->local_dir = path;
+  FileList *list = &app->local_working_dir;
+  file_list_clear(list);
+  file_list_reserve(list, tree.entries.size(), tree.names.size());
+
+  for (auto &entry : tree.entries) {
+    auto kind = entry.kind == ScanKind::Dir ? FileKind::Dir : FileKind::File;
+    file_list_add(list, scan_name(tree, entry), kind, entry.size,
+                  entry.mtime);
+  }
+  file_list_sort(list, 0);
+  app->local_version++;
+
+  write_config(*config);
+}
+
+constexpr u64 UPLOAD_CHUNK_SIZE = 1024 * 1024;
+
+// bytes of file chunks one session may hold in memory
+constexpr u64 UPLOAD_READ_BUDGET = 16 * 1024 * 1024;
+
+// how many remote files a session keeps open at once
+constexpr u64 UPLOAD_OPEN_FILES = 64;
+
+constexpr u32 IO_READ = 1;
+constexpr u32 IO_WRITE = 2;
+
+// the sockets an io loop waits on. epoll keeps the interest list in the
+// kernel, so a pass only tells it about sockets whose events changed.
+// windows, or linux without an epoll instance, polls the sockets that wait
+// for something
+struct IoPoll {
+  std::unordered_map<SOCKET, u32> events; // 0 if it waits for nothing
+#ifndef _WIN32
+  i32 epfd = -1;
+#endif
+};
+
+static void io_poll_init(IoPoll *p) {
+#ifndef _WIN32
+  p->epfd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+}
+
+static void io_poll_destroy(IoPoll *p) {
+#ifndef _WIN32
+  if (p->epfd >= 0) {
+    close(p->epfd);
+  }
+#endif
+  *p = {};
+}
+
+static void io_poll_set(IoPoll *p, SOCKET sock, u32 events) {
+  u32 &had = p->events[sock];
+  if (had == events) {
+    return;
+  }
+
+#ifndef _WIN32
+  epoll_event ev = {};
+  ev.events = ((events & IO_READ) ? EPOLLIN : 0) |
+              ((events & IO_WRITE) ? EPOLLOUT : 0);
+  ev.data.fd = sock;
+  if (p->epfd >= 0 && events == 0) {
+    epoll_ctl(p->epfd, EPOLL_CTL_DEL, sock, nullptr);
+  } else if (p->epfd >= 0) {
+    epoll_ctl(p->epfd, had == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, sock, &ev);
+  }
+#endif
+  had = events;
+}
+
+// has to be called before the socket is closed, its number can be reused
+static void io_poll_remove(IoPoll *p, SOCKET sock) {
+  io_poll_set(p, sock, 0);
+  p->events.erase(sock);
+}
+
+// the callers look at every socket after a wait, so what's ready isn't
+// returned
+static void io_poll_wait(IoPoll *p, i32 timeout_ms) {
+#ifndef _WIN32
+  if (p->epfd >= 0) {
+    epoll_event ready[64];
+    epoll_wait(p->epfd, ready, array_size(ready), timeout_ms);
+    return;
+  }
+#endif
+
+  std::vector<WSAPOLLFD> fds;
+  for (auto [sock, events] : p->events) {
+    if (events != 0) {
+      WSAPOLLFD fd = {};
+      fd.fd = sock;
+      fd.events = ((events & IO_READ) ? POLLIN : 0) |
+                  ((events & IO_WRITE) ? POLLOUT : 0);
+      fds.push_back(fd);
+    }
+  }
+  if (fds.empty()) {
+    // windows doesn't take an empty poll
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(std::max(timeout_ms, 0)));
+    return;
+  }
+  WSAPoll(fds.data(), (u32)fds.size(), timeout_ms);
+}
+
+// libssh2 reports which direction the last call blocked on, so only those
+// events are waited for. replies are read whenever a coroutine waits on one
+static u32 net_events(const Net &net) {
+  u32 events = 0;
+  i32 dir = libssh2_session_block_directions(net.session);
+  if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
+    events |= IO_WRITE;
+  }
+  if ((dir & LIBSSH2_SESSION_BLOCK_INBOUND) || !net.pipe->waiters.empty()) {
+    events |= IO_READ;
+  }
+  return events;
+}
+
+// runs the coroutines on the connections until pending drops to zero. if
+// one connection fails they all do, so nothing is left suspended. returns
+// false if they failed
+static bool sftp_drive(Net *nets, u32 count, const i32 *pending,
+                       const std::atomic<bool> *quit) {
+  for (u32 i = 0; i < count; i++) {
+    libssh2_session_set_blocking(nets[i].session, 0);
+  }
+  defer(for (u32 i = 0; i < count; i++) {
+    libssh2_session_set_blocking(nets[i].session, 1);
+  });
+
+  auto fail_all = [&](i32 rc) {
+    for (u32 i = 0; i < count; i++) {
+      sftp_fail(nets[i].pipe, rc);
+    }
+  };
+
+  IoPoll poll;
+  io_poll_init(&poll);
+  defer(io_poll_destroy(&poll));
+
+  while (*pending > 0) {
+    if (quit && *quit) {
+      fail_all(LIBSSH2_ERROR_CHANNEL_CLOSED);
+    }
+
+    f64 now = now_seconds();
+    for (u32 i = 0; i < count; i++) {
+      SftpPipe *pipe = nets[i].pipe;
+      if (!pipe->sent.empty() && now - pipe->heard_at > SESSION_STALL) {
+        sftp_fail(pipe, LIBSSH2_ERROR_TIMEOUT);
+      }
+
+      // a failed pipe resumes every coroutine, and every await after that
+      // completes right away, so nothing is left running
+      if (sftp_run(pipe) < 0 || pipe->failed) {
+        fail_all(LIBSSH2_ERROR_CHANNEL_CLOSED);
+        return false;
+      }
+
+      io_poll_set(&poll, nets[i].sock, net_events(nets[i]));
+    }
+
+    if (*pending == 0) {
+      break;
+    }
+
+    // a coroutine on one connection can wake one on another, which then
+    // waits in that pipe's yielded list
+    bool yielded = false;
+    for (u32 i = 0; i < count; i++) {
+      yielded |= !nets[i].pipe->yielded.empty();
+    }
+
+    // yielded coroutines wait on something outside of the sockets. the
+    // timeout also bounds how long quit goes unnoticed
+    io_poll_wait(&poll, yielded ? 1 : 100);
+  }
+
+  return true;
+}
+
+static Task<> listing_read(RemoteListing *l, SftpPipe *pipe) {
+  defer(l->pending--);
+
+  while (true) {
+    auto names = co_await sftp_readdir(pipe, l->handle);
+    if (!names) {
+      l->failed = true;
+      break;
+    }
+
+    // a listing that's given up on still reads the replies it asked for,
+    // the connection stays usable for the next one
+    if (names->empty() || l->quit || l->asked != l->job) {
+      break;
+    }
+
+    FileList batch;
+    for (auto &name : *names) {
+      if (name.name == "." || name.name == "..") {
+        continue;
+      }
+
+      FileKind kind = FileKind::File;
+      if ((name.attrs.permissions & LIBSSH2_SFTP_S_IFMT) ==
+          LIBSSH2_SFTP_S_IFDIR) {
+        kind = FileKind::Dir;
+      }
+
+      u64 size = 0;
+      if (name.attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
+        size = name.attrs.size;
+      }
+
+      u32 mtime = 0;
+      if (name.attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+        mtime = (u32)name.attrs.mtime;
+      }
+
+      file_list_add(&batch, name.name, kind, size, mtime);
+    }
+
+    {
+      std::lock_guard lock(l->mtx);
+      file_list_append(&l->incoming, batch);
+    }
+    glfwPostEmptyEvent();
+  }
+
+  // every reader stops at its own end of directory reply, the last one
+  // closes the handle
+  if (--l->readers == 0) {
+    co_await sftp_close(pipe, l->handle);
+  }
+}
+
+static Task<> listing_open(RemoteListing *l, SftpPipe *pipe) {
+  defer(l->pending--);
+
+  auto handle = co_await sftp_opendir(pipe, l->path);
+  if (!handle) {
+    l->failed = true;
+    co_return;
+  }
+
+  if (l->quit || l->asked != l->job) {
+    co_await sftp_close(pipe, *handle);
+    co_return;
+  }
+
+  l->handle = *handle;
+  l->readers = LISTING_READDIRS;
+  for (i32 i = 0; i < LISTING_READDIRS; i++) {
+    l->pending++;
+    spawn(listing_read(l, pipe));
+  }
+}
+
+// dials the connection once the backoff delay has passed. redials back
+// off the same way the transfer connector's do
+static bool listing_redial(RemoteListing *l, Net *net) {
+  {
+    std::unique_lock lock(l->mtx);
+    auto delay =
+        std::chrono::duration<f64>(std::max(l->redial_at - now_seconds(), 0.0));
+    if (l->cv.wait_for(lock, delay, [&]() { return l->quit.load(); })) {
+      return false;
+    }
+  }
+
+  auto dialed = server_dial(l->host.data(), l->user.data(),
+                            l->priv_key.data(), nullptr);
+  if (!dialed) {
+    f64 delay =
+        std::min(RECONNECT_MIN * std::exp2(l->dial_failures), RECONNECT_MAX);
+    l->dial_failures++;
+    l->redial_at = now_seconds() + delay;
+    return false;
+  }
+
+  *net = *dialed;
+  l->dial_failures = 0;
+  return true;
+}
+
+static void listing_loop(RemoteListing *l, Net *net) {
+  f64 keepalive_at = now_seconds() + KEEPALIVE_INTERVAL;
+
+  while (true) {
+    bool idle = false;
+    {
+      std::unique_lock lock(l->mtx);
+      f64 wake_at = net->session ? keepalive_at : l->redial_at;
+      auto timeout =
+          std::chrono::duration<f64>(std::max(wake_at - now_seconds(), 0.0));
+      l->cv.wait_for(lock, timeout,
+                     [&]() { return l->quit || l->asked != l->job; });
+      if (l->quit) {
+        return;
+      }
+      idle = l->asked == l->job;
+      if (!idle) {
+        l->job = l->asked;
+        l->path = l->wanted;
+        l->reading = l->job;
+        file_list_clear(&l->incoming);
+      }
+    }
+
+    // a dead link is only noticed when something is sent on it, so an idle
+    // one gets keepalives. one that dropped is dialed again in the
+    // background, the next directory doesn't wait on the handshake
+    if (idle) {
+      if (!net->session) {
+        listing_redial(l, net);
+      } else if (now_seconds() >= keepalive_at) {
+        i32 next = 0;
+        if (libssh2_keepalive_send(net->session, &next) < 0) {
+          server_disconnect(net);
+          l->redial_at = now_seconds();
+        }
+      }
+      keepalive_at = now_seconds() + KEEPALIVE_INTERVAL;
+      continue;
+    }
+
+    bool ok = false;
+    if (net->session || listing_redial(l, net)) {
+      l->failed = false;
+      l->pending = 1;
+      spawn(listing_open(l, net->pipe));
+      ok = sftp_drive(net, 1, &l->pending, nullptr);
+      if (!ok) {
+        server_disconnect(net);
+        l->redial_at = now_seconds();
+      }
+      ok = ok && !l->failed;
+      keepalive_at = now_seconds() + KEEPALIVE_INTERVAL;
+    }
+
+    {
+      std::lock_guard lock(l->mtx);
+      l->finished = l->job;
+      l->finished_ok = ok;
+    }
+    glfwPostEmptyEvent();
+  }
+}
+
+// the connection belongs to the listing thread from here on
+static void listing_start(RemoteListing *l, Net *net, const Config &config) {
+  l->host = config.host;
+  l->user = config.user;
+  l->priv_key = config.priv_key;
+  l->dial_failures = 0;
+  l->redial_at = 0;
+  l->thread = std::thread(listing_loop, l, net);
+}
+
+static void listing_stop(RemoteListing *l) {
+  if (l->thread.joinable()) {
+    {
+      std::lock_guard lock(l->mtx);
+      l->quit = true;
+    }
+    l->cv.notify_one();
+    l->thread.join();
+  }
+  l->quit = false;
+}
+
+static CachedDir *remote_cache_get(RemoteCache *c, const std::string &path) {
+  auto it = c->dirs.find(path);
+  if (it == c->dirs.end()) {
+    return nullptr;
+  }
+  it->second.used = ++c->clock;
+  return &it->second;
+}
+
+static void remote_cache_put(RemoteCache *c, const std::string &path,
+                             const FileList &list) {
+  CachedDir &dir = c->dirs[path];
+  c->entries -= file_list_size(dir.list);
+  dir.list = list;
+  dir.used = ++c->clock;
+  c->entries += file_list_size(list);
+
+  while (c->entries > REMOTE_CACHE_ENTRIES && c->dirs.size() > 1) {
+    auto oldest = c->dirs.begin();
+    for (auto it = c->dirs.begin(); it != c->dirs.end(); it++) {
+      if (it->second.used < oldest->second.used) {
+        oldest = it;
+      }
+    }
+    c->entries -= file_list_size(oldest->second.list);
+    c->dirs.erase(oldest);
+  }
+}
+
+static void change_remote_dir(App *app, Config *config,
+                              const std::string &path) {
+  RemoteListing *l = &app->remote_listing;
+  {
+    std::lock_guard lock(l->mtx);
+    l->wanted = path;
+    l->asked++;
+  }
+  l->cv.notify_one();
+
+  // a directory listed before is shown as it was until the new listing
+  // is complete
+  file_list_clear(&l->fresh);
+  l->patches.clear();
+  l->revalidating = false;
+  if (CachedDir *dir = remote_cache_get(&app->remote_cache, path)) {
+    l->revalidating = true;
+    l->shown = l->asked;
+    app->remote_working_dir = dir->list;
+    app->remote_version++;
+    config->remote_dir = path;
+    write_config(*config);
+  }
+}
+
+// returns true if the entry is new to the list. a directory that's
+// listed already is left as it is
+static bool remote_list_patch(FileList *list, const RemotePatch &patch) {
+  bool added = file_list_find(*list, patch.name) < 0;
+  if (added || patch.kind == FileKind::File) {
+    file_list_put(list, patch.name, patch.kind, patch.size, patch.mtime);
+  }
+  return added;
+}
+
+// puts what an upload did into the cached listings and the panel, so the
+// directories it touched don't have to be listed again to show it.
+// directories it may have created are added to their parents too
+static void remote_cache_patch(App *app, const Config &config,
+                               const TransferResult &result) {
+  RemoteListing *l = &app->remote_listing;
+  RemoteCache *c = &app->remote_cache;
+  std::string child = result.job.remote;
+  RemotePatch patch = {"", FileKind::File, result.size, result.mtime};
+  while (true) {
+    u64 slash = child.find_last_of('/');
+    if (slash == std::string::npos || slash == 0) {
+      break;
+    }
+    std::string dir = child.substr(0, slash);
+    patch.name = child.substr(slash + 1);
+
+    // not a use of the directory, it shouldn't keep it in the cache
+    auto cached = c->dirs.find(dir);
+    if (cached != c->dirs.end() &&
+        remote_list_patch(&cached->second.list, patch)) {
+      c->entries++;
+    }
+
+    // a listing still being read replaces the panel and the cached entries
+    // when it completes, so the patch is put in again then
+    if (l->settled != l->asked && dir == l->wanted) {
+      l->patches.push_back(patch);
+    } else if (dir == config.remote_dir) {
+      remote_list_patch(&app->remote_working_dir, patch);
+      app->remote_version++;
+    }
+
+    child = std::move(dir);
+    patch = {"", FileKind::Dir, 0, 0};
+  }
+}
+
+// merges entries that arrived since the last frame into the sorted panel.
+// the old directory stays on screen until the new one has something to show
+static void listing_update(App *app, Config *config) {
+  RemoteListing *l = &app->remote_listing;
+  u32 asked = l->asked;
+  if (l->settled == asked) {
+    return;
+  }
+
+  // entries of a request that's been replaced are left to the thread
+  FileList batch;
+  bool finished = false;
+  bool ok = false;
+  {
+    std::lock_guard lock(l->mtx);
+    if (l->reading == asked) {
+      std::swap(batch, l->incoming);
+    }
+    if (l->finished == asked) {
+      finished = true;
+      ok = l->finished_ok;
+    }
+  }
+
+  u32 count = file_list_size(batch);
+  if (!l->revalidating && l->shown != asked &&
+      (count > 0 || (finished && ok))) {
+    l->shown = asked;
+    file_list_clear(&app->remote_working_dir);
+    app->remote_version++;
+    config->remote_dir = l->wanted;
+    write_config(*config);
+  }
+
+  if (count > 0) {
+    FileList *dir = l->revalidating ? &l->fresh : &app->remote_working_dir;
+    u32 mid = file_list_size(*dir);
+    file_list_append(dir, batch);
+    file_list_sort(dir, mid);
+    if (!l->revalidating) {
+      app->remote_version++;
+    }
+  }
+
+  if (!finished) {
+    return;
+  }
+
+  l->settled = asked;
+  if (ok && l->revalidating) {
+    std::swap(app->remote_working_dir, l->fresh);
+    file_list_clear(&l->fresh);
+    app->remote_version++;
+  }
+
+  // a failed listing leaves the panel as it was, which is missing them too.
+  // the panel may still show the last directory if nothing came in
+  if (l->shown == asked) {
+    for (auto &patch : l->patches) {
+      remote_list_patch(&app->remote_working_dir, patch);
+      app->remote_version++;
+    }
+  }
+  l->patches.clear();
+
+  if (!ok) {
+    error_message(L"failed to read remote dir");
+    return;
+  }
+  remote_cache_put(&app->remote_cache, l->wanted, app->remote_working_dir);
+}
+
+static u32 unix_seconds(fs::file_time_type time) {
+  auto sys = fs::file_time_type::clock::to_sys(time);
+  return (u32)std::chrono::duration_cast<std::chrono::seconds>(
+             sys.time_since_epoch())
+      .count();
+}
+
+static u32 local_mtime(const std::string &path) {
+  std::error_code ec;
+  auto time = fs::last_write_time(path, ec);
+  if (ec) {
+    return 0;
+  }
+
+  return unix_seconds(time);
+}
+
+static std::optional<IndexEntry> index_find(UploadIndex *index,
+                                            const std::string &remote) {
+  std::lock_guard lock(index->mtx);
+  return index_get(&index->store, remote);
+}
+
+static void index_put(UploadIndex *index, const std::string &remote,
+                      IndexEntry entry) {
+  std::lock_guard lock(index->mtx);
+  index_set(&index->store, remote, entry);
+}
+
+// opens a chunk reader counted against the session's read budget
+static bool upload_reader_open(IoSession *s, ChunkReader *reader,
+                               const std::string &path, u64 size) {
+  // small files get small buffers
+  u64 chunk_size = std::clamp<u64>(size, SFTP_WRITE_SIZE, UPLOAD_CHUNK_SIZE);
+  if (!reader_open(reader, s->reads, path, chunk_size)) {
+    return false;
+  }
+  s->buffered += reader->chunk_size * 2;
+  return true;
+}
+
+static void upload_reader_close(IoSession *s, ChunkReader *reader) {
+  s->buffered -= reader->chunk_size * 2;
+  reader_close(reader);
+}
+
+static Task<std::optional<u64>> hash_task(IoSession *s,
+                                          const std::string &path, u64 size) {
+  ChunkReader reader;
+  if (!upload_reader_open(s, &reader, path, size)) {
+    co_return std::nullopt;
+  }
+  defer(upload_reader_close(s, &reader));
+
+  Hash64 hash;
+  hash64_init(&hash);
+  while (!s->net.pipe->failed) {
+    const char *data = nullptr;
+    u64 len = reader_peek(&reader, &data, UPLOAD_CHUNK_SIZE);
+    if (len == 0) {
+      if (reader.eof) {
+        break;
+      }
+
+      co_await SftpYield{s->net.pipe};
+      continue;
+    }
+
+    hash64_update(&hash, data, len);
+    reader.pos += len;
+  }
+
+  if (!reader.eof || reader.failed) {
+    co_return std::nullopt;
+  }
+  co_return hash64_final(&hash);
+}
+
+enum class UploadStatus : i32 {
+  Failed,
+  Uploaded,
+  Unchanged,
+};
+
+static Task<UploadStatus> upload_task(IoSession *s, TransferJob *job,
+                                      TransferResult *result) {
+  SftpPipe *pipe = s->net.pipe;
+
+  std::error_code ec;
+  u64 size = fs::file_size(job->local, ec);
+  if (ec) {
+    co_return UploadStatus::Failed;
+  }
+  u32 mtime = local_mtime(job->local);
+  result->size = size;
+  result->mtime = mtime;
+
+  SftpAttrs attrs;
+  attrs.flags = LIBSSH2_SFTP_ATTR_ACMODTIME;
+  attrs.atime = attrs.mtime = mtime;
+
+  // touched or rewritten with the same bytes. only the size can rule out a
+  // change without reading the file
+  auto last = index_find(s->index, job->remote);
+  if (last && last->size == size) {
+    auto hash = co_await hash_task(s, job->local, size);
+    if (hash && *hash == last->hash) {
+      if (mtime != 0 && last->mtime != mtime) {
+        if (!co_await sftp_setstat(pipe, job->remote, attrs)) {
+          co_return UploadStatus::Failed;
+        }
+        index_put(s->index, job->remote, {size, mtime, *hash});
+      }
+      co_return UploadStatus::Unchanged;
+    }
+  }
+
+  // the first chunk is read while the OPEN request is in flight
+  ChunkReader reader;
+  if (!upload_reader_open(s, &reader, job->local, size)) {
+    co_return UploadStatus::Failed;
+  }
+  defer(upload_reader_close(s, &reader));
+
+  constexpr u32 pflags =
+      LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC;
+  constexpr u32 mode = LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR |
+                       LIBSSH2_SFTP_S_IRGRP | LIBSSH2_SFTP_S_IROTH;
+
+  auto handle = co_await sftp_open(pipe, job->remote, pflags, mode);
+  if (!handle) {
+    u64 slash = job->remote.find_last_of('/');
+    if (slash == std::string::npos ||
+        !co_await sftp_mkdir_p(pipe, job->remote.substr(0, slash))) {
+      co_return UploadStatus::Failed;
+    }
+
+    handle = co_await sftp_open(pipe, job->remote, pflags, mode);
+    if (!handle) {
+      co_return UploadStatus::Failed;
+    }
+  }
+
+  bool ok = true;
+  u64 offset = 0;
+  Hash64 hash;
+  hash64_init(&hash);
+  std::deque<SftpCall<bool>> writes;
+  while (!pipe->failed) {
+    const char *data = nullptr;
+    u64 len = reader_peek(&reader, &data, SFTP_WRITE_SIZE);
+    if (len == 0) {
+      if (reader.eof) {
+        break;
+      }
+
+      co_await SftpYield{pipe};
+      continue;
+    }
+
+    co_await SftpWindow{pipe};
+    if (pipe->failed) {
+      break;
+    }
+
+    writes.push_back(sftp_write(pipe, *handle, offset, data, (u32)len));
+    hash64_update(&hash, data, len);
+    reader.pos += len;
+    offset += len;
+
+    // collect replies that already came back
+    while (!writes.empty() && writes.front().await_ready()) {
+      ok &= writes.front().await_resume();
+      writes.pop_front();
+    }
+  }
+
+  for (auto &write : writes) {
+    ok &= co_await write;
+  }
+
+  ok &= !reader.failed;
+  ok &= co_await sftp_close(pipe, *handle);
+  if (!ok) {
+    co_return UploadStatus::Failed;
+  }
+
+  if (mtime != 0) {
+    co_await sftp_setstat(pipe, job->remote, attrs);
+  }
+
+  index_put(s->index, job->remote, {offset, mtime, hash64_final(&hash)});
+  result->size = offset;
+  co_return UploadStatus::Uploaded;
+}
+
+static Task<> upload_job(IoSession *s, TransferJob job) {
+  f64 start = now_seconds();
+
+  TransferResult result;
+  if (job.changed_at != 0) {
+    result.latency = start - job.changed_at;
+  }
+  UploadStatus status = co_await upload_task(s, &job, &result);
+  result.ok = status != UploadStatus::Failed;
+  result.unchanged = status == UploadStatus::Unchanged;
+  result.seconds = now_seconds() - start;
+  result.job = std::move(job);
+  s->results.push_back(std::move(result));
+  s->running--;
+}
+
+// starts uploads from the waiting list while there is room for them, then
+// runs the pipe. returns a libssh2 error if the connection failed
+static i32 session_step(IoSession *s) {
+  while (true) {
+    bool started = false;
+    while (!s->waiting.empty() && s->running < UPLOAD_OPEN_FILES &&
+           (s->running == 0 || s->buffered < UPLOAD_READ_BUDGET)) {
+      TransferJob job = std::move(s->waiting.front());
+      s->waiting.pop_front();
+
+      s->running++;
+      spawn(upload_job(s, std::move(job)));
+      started = true;
+    }
+
+    i32 rc = sftp_run(s->net.pipe);
+    if (rc < 0) {
+      return rc;
+    }
+
+    // uploads that finished while running the pipe make room for more
+    if (!started || s->waiting.empty() || s->running >= UPLOAD_OPEN_FILES) {
+      return 0;
+    }
+  }
+}
+
+static void session_fail(IoSession *s) {
+  sftp_fail(s->net.pipe, LIBSSH2_ERROR_CHANNEL_CLOSED);
+
+  for (auto &job : s->waiting) {
+    TransferResult result;
+    result.job = std::move(job);
+    s->results.push_back(std::move(result));
+  }
+  s->waiting.clear();
+}
+
+static bool waker_init(IoWaker *waker) {
+  // a loopback udp socket connected to itself. poll sees it as readable
+  // after another thread sends a byte to it
+  SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock == INVALID_SOCKET) {
+    return false;
+  }
+
+  sockaddr_in sin = {};
+  sin.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &sin.sin_addr);
+
+  socklen_t len = sizeof(sin);
+  if (bind(sock, (sockaddr *)&sin, len) ||
+      getsockname(sock, (sockaddr *)&sin, &len) ||
+      connect(sock, (sockaddr *)&sin, len)) {
+    closesocket(sock);
+    return false;
+  }
+
+#ifdef _WIN32
+  u_long nonblocking = 1;
+  ioctlsocket(sock, FIONBIO, &nonblocking);
+#else
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+#endif
+
+  waker->sock = sock;
+  return true;
+}
+
+static void waker_signal(IoWaker *waker) {
+  char byte = 0;
+  send(waker->sock, &byte, 1, 0);
+}
+
+static void waker_drain(IoWaker *waker) {
+  char buf[64];
+  while (recv(waker->sock, buf, sizeof(buf), 0) > 0) {
+  }
+}
+
+static void waker_destroy(IoWaker *waker) {
+  if (waker->sock != INVALID_SOCKET) {
+    closesocket(waker->sock);
+  }
+  *waker = {};
+}
+
+// blocks until one of the sessions can make progress, the waker is
+// signaled or the timeout passes
+static void io_wait(IoPoll *poll, std::list<IoSession> &sessions,
+                    i32 timeout_ms) {
+  for (auto &s : sessions) {
+    io_poll_set(poll, s.net.sock, net_events(s.net));
+  }
+  io_poll_wait(poll, timeout_ms);
+}
+
+// redials after a failure back off exponentially, every failed attempt in
+// a row doubles the delay
+static void connector_dialed(TransferPool *pool, std::optional<Net> net) {
+  std::lock_guard lock(pool->mtx);
+  pool->dialing--;
+
+  if (net) {
+    pool->spare.push_back(*net);
+    pool->dial_failures = 0;
+    for (auto &waker : pool->wakers) {
+      waker_signal(&waker);
+    }
+  } else {
+    f64 delay = std::min(RECONNECT_MIN * std::exp2(pool->dial_failures),
+                         RECONNECT_MAX);
+    pool->dial_failures++;
+    pool->redial_at = now_seconds() + delay;
+  }
+
+  pool->connector_cv.notify_all();
+  glfwPostEmptyEvent();
+}
+
+// keeps enough authenticated sessions in spare for the io threads and the
+// standby. dials run in parallel so a pool comes up in one handshake time
+static void connector_loop(TransferPool *pool) {
+  std::vector<std::future<void>> dials;
+  f64 keepalive_at = 0;
+
+  std::unique_lock lock(pool->mtx);
+  while (!pool->quit) {
+    f64 now = now_seconds();
+
+    // idle spares get keepalives too, one whose link died is dropped.
+    // the sends can block, so they're done without the lock
+    if (now >= keepalive_at) {
+      keepalive_at = now + KEEPALIVE_INTERVAL;
+
+      std::vector<Net> idle;
+      idle.swap(pool->spare);
+      lock.unlock();
+
+      std::vector<Net> alive;
+      for (auto &net : idle) {
+        i32 next = 0;
+        if (libssh2_keepalive_send(net.session, &next) < 0) {
+          server_disconnect(&net);
+        } else {
+          alive.push_back(net);
+        }
+      }
+
+      lock.lock();
+      pool->spare.insert(pool->spare.end(), alive.begin(), alive.end());
+      continue;
+    }
+
+    u64 want = pool->missing + pool->standby;
+    u64 have = pool->spare.size() + pool->dialing;
+    if (have < want && now >= pool->redial_at) {
+      for (; have < want; have++) {
+        pool->dialing++;
+        dials.push_back(std::async(std::launch::async, [pool]() {
+          connector_dialed(pool, server_dial(pool->host.data(),
+                                             pool->user.data(),
+                                             pool->priv_key.data(), nullptr));
+        }));
+      }
+    }
+
+    auto done = [](std::future<void> &dial) {
+      return dial.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    };
+    dials.erase(std::remove_if(dials.begin(), dials.end(), done), dials.end());
+
+    f64 wake_at = keepalive_at;
+    if (have < want) {
+      wake_at = std::min(wake_at, pool->redial_at);
+    }
+    auto timeout = std::chrono::duration<f64>(std::max(wake_at - now, 0.0));
+    pool->connector_cv.wait_for(lock, timeout);
+  }
+
+  lock.unlock();
+  for (auto &dial : dials) {
+    dial.wait();
+  }
+}
+
+static void transfer_loop(TransferPool *pool, IoWaker *waker, u32 count) {
+  // coroutines hold pointers to their session, so it must not move
+  std::list<IoSession> sessions;
+
+  // finished reads wake the loop, the upload waiting on one goes on then
+  ReadThread reads;
+  read_thread_start(
+      &reads, [](void *ctx) { waker_signal((IoWaker *)ctx); }, waker);
+  defer(read_thread_stop(&reads));
+
+  IoPoll poll;
+  io_poll_init(&poll);
+  io_poll_set(&poll, waker->sock, IO_READ);
+  defer(io_poll_destroy(&poll));
+
+  while (true) {
+    waker_drain(waker);
+
+    // everything queued or finished since the last pass, with one fsync
+    journal_sync(&pool->journal);
+
+    {
+      std::lock_guard lock(pool->mtx);
+      if (pool->quit) {
+        pool->connected -= (i32)sessions.size();
+        break;
+      }
+
+      while (sessions.size() < count && !pool->spare.empty()) {
+        Net net = pool->spare.back();
+        pool->spare.pop_back();
+        pool->missing--;
+        pool->connected++;
+        pool->connector_cv.notify_all();
+
+        libssh2_session_set_blocking(net.session, 0);
+        net.pipe->write_window = pool->write_window;
+
+        IoSession s;
+        s.net = net;
+        s.index = &pool->index;
+        s.reads = &reads;
+        sessions.push_back(std::move(s));
+      }
+
+      // a path that is already being uploaded has to wait, otherwise an
+      // older upload could finish after a newer one. each session takes a
+      // fair share so the others get work too
+      for (auto &s : sessions) {
+        u64 load = s.waiting.size() + s.running;
+        u64 share = (pool->queue.size() + pool->connected - 1) /
+                    std::max(pool->connected, 1);
+        share = std::min(share, TRANSFER_BATCH_SIZE -
+                                    std::min(load, TRANSFER_BATCH_SIZE));
+
+        for (auto it = pool->queue.begin();
+             it != pool->queue.end() && share > 0;) {
+          if (pool->busy.count(it->remote)) {
+            it++;
+            continue;
+          }
+
+          pool->busy.insert(it->remote);
+          pool->active++;
+          s.waiting.push_back(std::move(*it));
+          it = pool->queue.erase(it);
+          share--;
+        }
+      }
+    }
+
+    f64 now = now_seconds();
+    i32 timeout_ms = -1;
+    for (auto it = sessions.begin(); it != sessions.end();) {
+      IoSession &s = *it;
+
+      i32 rc = session_step(&s);
+
+      // a dead link usually shows up as silence, not as an error
+      i32 next = 0;
+      if (rc >= 0) {
+        rc = libssh2_keepalive_send(s.net.session, &next);
+        rc = rc == LIBSSH2_ERROR_EAGAIN ? 0 : rc;
+      }
+      if (rc >= 0 && !s.net.pipe->sent.empty() &&
+          now - s.net.pipe->heard_at > SESSION_STALL) {
+        rc = LIBSSH2_ERROR_TIMEOUT;
+      }
+
+      if (rc < 0) {
+        session_fail(&s);
+      }
+
+      if (!s.results.empty()) {
+        {
+          std::lock_guard lock(pool->mtx);
+          for (auto &result : s.results) {
+            pool->busy.erase(result.job.remote);
+            pool->active--;
+
+            // uploads cut off by the connection go back to the front of
+            // the queue for the next session
+            if (rc < 0 && !result.ok) {
+              pool->queue.push_front(std::move(result.job));
+              continue;
+            }
+
+            if (result.ok) {
+              journal_done(&pool->journal, result.job.remote,
+                           result.job.journal_seq);
+            }
+            pool->results.push_back(std::move(result));
+          }
+        }
+        glfwPostEmptyEvent();
+      }
+      s.results.clear();
+
+      if (rc < 0) {
+        io_poll_remove(&poll, s.net.sock);
+        server_disconnect(&s.net);
+        it = sessions.erase(it);
+
+        std::lock_guard lock(pool->mtx);
+        pool->connected--;
+        pool->missing++;
+        pool->reconnects++;
+        pool->connector_cv.notify_all();
+        continue;
+      }
+
+      // uploads waiting on a disk read are woken by the read thread.
+      // replies are waited on no longer than it takes to call the link
+      // stalled
+      i32 wait_ms = next > 0 ? next * 1000 : -1;
+      if (!s.net.pipe->sent.empty()) {
+        wait_ms = 1000;
+      }
+      if (wait_ms >= 0) {
+        timeout_ms = timeout_ms < 0 ? wait_ms : std::min(timeout_ms, wait_ms);
+      }
+      it++;
+    }
+
+    io_wait(&poll, sessions, timeout_ms);
+  }
+
+  for (auto &s : sessions) {
+    session_fail(&s);
+
+    std::lock_guard lock(pool->mtx);
+    for (auto &result : s.results) {
+      pool->busy.erase(result.job.remote);
+      pool->active--;
+    }
+  }
+
+  for (auto &s : sessions) {
+    server_disconnect(&s.net);
+  }
+}
+
+// file in the index dir for the server and user, without an extension
+// for the index itself
+static std::string state_path(const Config &config, const char *ext) {
+  std::string key = config.user + "@" + config.host;
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx%s",
+           (unsigned long long)hash64(key.data(), key.size()), ext);
+  return (fs::path(INDEX_DIR) / name).string();
+}
+
+static void transfer_start(TransferPool *pool, const Config &config) {
+  pool->host = config.host;
+  pool->user = config.user;
+  pool->priv_key = config.priv_key;
+  pool->write_window = config.write_window;
+  pool->quit = false;
+
+  {
+    std::lock_guard lock(pool->index.mtx);
+    if (!index_open(&pool->index.store, state_path(config, ""))) {
+      error_message(L"cannot open upload index");
+    }
+  }
+
+  // uploads the last run didn't get to. files deleted since then are
+  // dropped from the journal
+  std::vector<JournalEntry> pending;
+  if (!journal_open(&pool->journal, state_path(config, ".journal"),
+                    &pending)) {
+    error_message(L"cannot open upload journal");
+  }
+
+  {
+    std::lock_guard lock(pool->mtx);
+    for (auto &entry : pending) {
+      std::error_code ec;
+      if (!fs::is_regular_file(entry.local, ec)) {
+        journal_done(&pool->journal, entry.remote, entry.seq);
+        continue;
+      }
+
+      TransferJob job;
+      job.filename = std::move(entry.filename);
+      job.local = std::move(entry.local);
+      job.remote = std::move(entry.remote);
+      job.journal_seq = entry.seq;
+      pool->queue.push_back(std::move(job));
+    }
+  }
+
+  u32 sessions = std::max(config.transfer_sessions, 1u);
+  u32 threads = std::clamp(config.transfer_threads, 1u, sessions);
+
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->missing = sessions;
+    pool->standby = config.standby_sessions;
+    pool->dial_failures = 0;
+    pool->redial_at = 0;
+    pool->reconnects = 0;
+  }
+
+  // wakers are created up front, threads keep pointers into the vector.
+  // the lock is for the watcher thread, which signals them
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->wakers.resize(threads);
+    for (u32 i = 0; i < threads; i++) {
+      if (!waker_init(&pool->wakers[i])) {
+        error_message(L"cannot create socket for transfer thread");
+      }
+    }
+  }
+
+  for (u32 i = 0; i < threads; i++) {
+    u32 count = sessions / threads + (i < sessions % threads ? 1 : 0);
+    pool->threads.emplace_back(transfer_loop, pool, &pool->wakers[i], count);
+  }
+
+  pool->connector = std::thread(connector_loop, pool);
+}
+
+static void transfer_stop(TransferPool *pool) {
+  {
+    std::lock_guard lock(pool->mtx);
+    pool->quit = true;
+    pool->connector_cv.notify_all();
+  }
+
+  for (auto &waker : pool->wakers) {
+    waker_signal(&waker);
+  }
+
+  for (auto &thread : pool->threads) {
+    thread.join();
+  }
+  pool->threads.clear();
+
+  if (pool->connector.joinable()) {
+    pool->connector.join();
+  }
+
+  for (auto &net : pool->spare) {
+    server_disconnect(&net);
+  }
+  pool->spare.clear();
+  pool->missing = 0;
+
+  std::lock_guard lock(pool->mtx);
+  for (auto &waker : pool->wakers) {
+    waker_destroy(&waker);
+  }
+
+  pool->wakers.clear();
+  pool->queue.clear();
+  pool->results.clear();
+
+  {
+    std::lock_guard index_lock(pool->index.mtx);
+    index_close(&pool->index.store);
+  }
+
+  // queued uploads stay in the journal for the next run
+  journal_close(&pool->journal);
+}
+
+static void transfer_enqueue(TransferPool *pool, TransferJob job) {
+  std::lock_guard lock(pool->mtx);
+
+  // a queued job reads the file when it starts, so it already covers
+  // this change
+  for (auto &queued : pool->queue) {
+    if (queued.remote == job.remote) {
+      return;
+    }
+  }
+
+  // an upload of the same path that's running may have read the file
+  // before this change, its done mustn't clear this add
+  job.journal_seq =
+      journal_add(&pool->journal, {job.filename, job.local, job.remote});
+  pool->queue.push_back(std::move(job));
+
+  for (auto &waker : pool->wakers) {
+    waker_signal(&waker);
+  }
+}
+
+static void change_queue_push(ChangeQueue *q, FileChange change) {
+  ChangeNode *node = new ChangeNode;
+  node->change = std::move(change);
+
+  ChangeNode *prev = q->head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+static bool change_queue_pop(ChangeQueue *q, FileChange *change) {
+  ChangeNode *next = q->tail->next.load(std::memory_order_acquire);
+  if (!next) {
+    return false;
+  }
+
+  *change = std::move(next->change);
+  delete q->tail;
+  q->tail = next;
+  return true;
+}
+
+// uploads the file if the change left it newer than the last upload.
+// returns true if an upload was queued
+static bool watch_change(WatchThread *w, FileChange &change) {
+  // editors often save by renaming a temp file over the original
+  if (change.type != FileAction::Modified &&
+      change.type != FileAction::RenamedNew) {
+    return false;
+  }
+
+  std::error_code ec;
+  auto local = w->local_dir / fs::path(change.filename);
+  if (!fs::is_regular_file(local, ec)) {
+    return false;
+  }
+
+  i64 modified = fs::last_write_time(local, ec).time_since_epoch().count();
+  if (ec || w->watcher.modtimes[change.filename] >= modified) {
+    return false;
+  }
+  w->watcher.modtimes[change.filename] = modified;
+
+  TransferJob job;
+  job.filename = change.filename;
+  job.local = local.string();
+  job.remote = w->remote_dir + "/" + fs::path(change.filename).generic_string();
+  job.changed_at = change.at;
+  transfer_enqueue(w->transfers, std::move(job));
+
+  change_queue_push(&w->uploads, std::move(change));
+  return true;
+}
+
+static void wheel_schedule(TimerWheel *wheel, const std::string &path,
+                           f64 deadline) {
+  u64 tick = std::max(wheel->tick, (u64)std::ceil(deadline / WHEEL_TICK));
+  wheel->slots[tick % WHEEL_SLOTS].push_back(path);
+}
+
+// ms until the next tick, or -1 if nothing is waiting
+static i32 wheel_timeout(TimerWheel *wheel, f64 now) {
+  if (wheel->pending.empty()) {
+    return -1;
+  }
+
+  f64 ms = (wheel->tick * WHEEL_TICK - now) * 1000;
+  return std::max((i32)std::ceil(ms), 0);
+}
+
+// holds the change back until the path has been quiet for the quiet period
+static void watch_debounce(WatchThread *w, FileChange change) {
+  if (change.type != FileAction::Modified &&
+      change.type != FileAction::RenamedNew) {
+    return;
+  }
+
+  TimerWheel *wheel = &w->quiet;
+  if (wheel->pending.empty()) {
+    wheel->tick = (u64)(change.at / WHEEL_TICK);
+  }
+
+  w->events++;
+  f64 deadline = change.at + w->quiet_period;
+  auto [it, inserted] = wheel->pending.try_emplace(change.filename);
+  it->second.change = std::move(change);
+  it->second.deadline = deadline;
+  if (inserted) {
+    wheel_schedule(wheel, it->first, deadline);
+  }
+}
+
+// runs the wheel up to now. returns true if an upload was queued
+static bool watch_settle(WatchThread *w, f64 now) {
+  TimerWheel *wheel = &w->quiet;
+
+  bool uploaded = false;
+  while (!wheel->pending.empty() && wheel->tick * WHEEL_TICK <= now) {
+    std::vector<std::string> due;
+    due.swap(wheel->slots[wheel->tick % WHEEL_SLOTS]);
+    wheel->tick++;
+
+    for (auto &path : due) {
+      auto it = wheel->pending.find(path);
+      if (it == wheel->pending.end()) {
+        continue;
+      }
+
+      // changed again, or due on a later lap of the wheel
+      if (it->second.deadline > now) {
+        wheel_schedule(wheel, path, it->second.deadline);
+        continue;
+      }
+
+      FileChange change = std::move(it->second.change);
+      wheel->pending.erase(it);
+      w->settled++;
+      uploaded |= watch_change(w, change);
+    }
+  }
+
+  return uploaded;
+}
+
+using ModTimes = std::unordered_map<std::string, i64>;
+
+// reports files under dir written after since that are newer than their
+// last upload. recursive is false for the top level, whose subdirectories
+// are given to other workers
+static void watch_rescan_dir(WatchThread *w, fs::path dir, bool recursive,
+                             fs::file_time_type since,
+                             std::shared_ptr<const ModTimes> index) {
+  auto check = [&](const fs::directory_entry &entry) {
+    std::error_code ec;
+    if (!entry.is_regular_file(ec)) {
+      return;
+    }
+
+    auto modified = entry.last_write_time(ec);
+    if (ec || modified < since) {
+      return;
+    }
+
+    auto name = entry.path().lexically_relative(w->local_dir).string();
+    auto it = index->find(name);
+    if (it != index->end() &&
+        it->second >= modified.time_since_epoch().count()) {
+      return;
+    }
+
+    change_queue_push(&w->rescanned, {name, FileAction::Modified});
+  };
+
+  std::error_code ec;
+  if (recursive) {
+    auto opts = fs::directory_options::skip_permission_denied;
+    for (auto &entry : fs::recursive_directory_iterator(dir, opts, ec)) {
+      if (w->quit) {
+        return;
+      }
+      check(entry);
+    }
+  } else {
+    for (auto &entry : fs::directory_iterator(dir, ec)) {
+      check(entry);
+    }
+  }
+
+  watcher_wake(&w->watcher);
+}
+
+// changes were dropped, so the tree is compared against the upload index.
+// only files written since the watcher was last in sync can be stale. the
+// top level directories are split over a few workers
+static void watch_rescan(WatchThread *w) {
+  w->overflows++;
+
+  // some file systems store write times with a resolution of 2 seconds
+  auto since = w->watcher.synced_at - std::chrono::seconds(2);
+  auto index = std::make_shared<const ModTimes>(w->watcher.modtimes);
+
+  std::vector<fs::path> dirs;
+  std::error_code ec;
+  for (auto &entry : fs::directory_iterator(w->local_dir, ec)) {
+    if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+      dirs.push_back(entry.path());
+    }
+  }
+
+  u32 workers = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::vector<fs::path>> shares(
+      std::min<u64>(workers, dirs.size()));
+  for (u64 i = 0; i < dirs.size(); i++) {
+    shares[i % shares.size()].push_back(std::move(dirs[i]));
+  }
+
+  w->rescans.push_back(std::async(std::launch::async, [=]() {
+    watch_rescan_dir(w, w->local_dir, false, since, index);
+  }));
+
+  for (auto &share : shares) {
+    w->rescans.push_back(std::async(std::launch::async, [=]() {
+      for (auto &dir : share) {
+        watch_rescan_dir(w, dir, true, since, index);
+      }
+    }));
+  }
+}
+
+static void watch_loop(WatchThread *w) {
+  FileWatcher *watcher = &w->watcher;
+
+  while (true) {
+    watcher_wait(watcher, wheel_timeout(&w->quiet, now_seconds()));
+    if (w->quit) {
+      break;
+    }
+
+    watcher_poll(watcher);
+    if (watcher->overflowed) {
+      watch_rescan(w);
+    }
+
+    f64 now = now_seconds();
+    for (auto &change : watcher->changes) {
+      change.at = now;
+      watch_debounce(w, std::move(change));
+    }
+
+    FileChange change;
+    while (change_queue_pop(&w->rescanned, &change)) {
+      change.at = now;
+      watch_debounce(w, std::move(change));
+    }
+
+    bool uploaded = watch_settle(w, now_seconds());
+
+    std::erase_if(w->rescans, [](auto &rescan) {
+      return rescan.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+    });
+
+    if (uploaded || watcher->overflowed) {
+      glfwPostEmptyEvent();
+    }
+  }
+
+  // workers check quit between files
+  w->rescans.clear();
+}
+
+static bool watch_start(WatchThread *w, const Config &config,
+                        TransferPool *transfers) {
+  const wchar_t *error = nullptr;
+  if (!watcher_init(&w->watcher, config.local_dir, &error)) {
+    error_message(error);
+    return false;
+  }
+
+  w->local_dir = config.local_dir;
+  w->remote_dir = config.remote_dir;
+  w->transfers = transfers;
+  w->quit = false;
+  w->overflows = 0;
+  w->quiet = {};
+  w->quiet_period = config.quiet_ms / 1000.0;
+  w->events = 0;
+  w->settled = 0;
+  w->thread = std::thread(watch_loop, w);
+  return true;
+}
+
+static void watch_stop(WatchThread *w) {
+  if (!w->running()) {
+    return;
+  }
+
+  w->quit = true;
+  watcher_wake(&w->watcher);
+  w->thread.join();
 
-static const char *open_directory_dialog(GLFWwindow *window) {
-  static char s_result[MAX_PATH];
+  watcher_destroy(&w->watcher);
+}
 
-  IFileOpenDialog *dialog;
-  HRESULT result = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
-                                    IID_IFileOpenDialog, (void **)&dialog);
-  if (!SUCCEEDED(result)) {
-    return nullptr;
-  }
-  result = dialog->SetOptions(FOS_PICKFOLDERS | FOS_FORCEFILESYSTEM |
-                              FOS_PATHMUSTEXIST | FOS_FILEMUSTEXIST |
-                              FOS_NOCHANGEDIR);
-  defer(dialog->Release());
-  if (!SUCCEEDED(result)) {
-    return nullptr;
+static void remote_walk_wake(RemoteWalk *walk, u64 count) {
+  while (count > 0 && !walk->idle.empty()) {
+    auto [pipe, h] = walk->idle.back();
+    walk->idle.pop_back();
+    pipe->yielded.push_back(h);
+    count--;
   }
+}
 
-  result = dialog->Show(glfwGetWin32Window(window));
-  if (!SUCCEEDED(result)) {
-    return nullptr;
+static Task<bool> remote_walk_dir(RemoteWalk *walk, SftpPipe *pipe,
+                                  const std::string &dir) {
+  std::string path = dir.empty() ? walk->root : walk->root + "/" + dir;
+  auto handle = co_await sftp_opendir(pipe, path);
+  if (!handle) {
+    co_return false;
   }
 
-  IShellItem *item;
-  result = dialog->GetResult(&item);
-  if (!SUCCEEDED(result)) {
-    return nullptr;
-  }
+  bool ok = true;
+  while (ok) {
+    auto names = co_await sftp_readdir(pipe, *handle);
+    if (!names) {
+      ok = false;
+      break;
+    }
 
-  wchar_t *path;
-  result = item->GetDisplayName(SIGDN_FILESYSPATH, &path);
-  defer(item->Release());
+    if (names->empty()) {
+      break;
+    }
 
-  if (!SUCCEEDED(result)) {
-    return nullptr;
-  }
+    u64 queued = 0;
+    for (auto &name : *names) {
+      if (name.name == "." || name.name == "..") {
+        continue;
+      }
 
-  defer(CoTaskMemFree(path));
+      std::string rel = dir.empty() ? name.name : dir + "/" + name.name;
+      u32 type = name.attrs.permissions & LIBSSH2_SFTP_S_IFMT;
+      if (type == LIBSSH2_SFTP_S_IFDIR) {
+        walk->dirs.push_back(std::move(rel));
+        queued++;
+      } else if (type == LIBSSH2_SFTP_S_IFREG) {
+        walk->files[rel] = {name.attrs.size, name.attrs.mtime};
+        if (walk->found) {
+          (*walk->found)++;
+        }
+      }
+    }
 
-  errno_t err =
-      wcstombs_s(nullptr, s_result, array_size(s_result), path, _TRUNCATE);
-  if (err) {
-    return nullptr;
+    // subdirectories are handed out while this one is still being read
+    remote_walk_wake(walk, queued);
   }
 
-  return s_result;
+  co_await sftp_close(pipe, *handle);
+  co_return ok;
 }
 
-static std::optional<Net> server_connect(const char *host, const char *user,
-                                         const char *priv_key) {
-  LIBSSH2_SESSION *session = nullptr;
-  LIBSSH2_SFTP *sftp = nullptr;
+static Task<> remote_walk_worker(RemoteWalk *walk, SftpPipe *pipe) {
+  defer(walk->pending--);
 
-  SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+  while (walk->ok && !pipe->failed) {
+    if (walk->dirs.empty()) {
+      // nothing queued and nothing being read that could queue more
+      if (walk->reading == 0) {
+        break;
+      }
+      co_await RemoteWalkIdle{walk, pipe};
+      continue;
+    }
 
-  sockaddr_in sin = {};
-  sin.sin_family = AF_INET;
-  sin.sin_port = htons(22);
+    std::string dir = std::move(walk->dirs.front());
+    walk->dirs.pop_front();
 
-  in_addr addr = {};
-  if (strcmp(host, "localhost") == 0) {
-    inet_pton(AF_INET, "127.0.0.1", &addr);
-  } else {
-    inet_pton(AF_INET, host, &addr);
+    walk->reading++;
+    bool ok = co_await remote_walk_dir(walk, pipe, dir);
+    walk->reading--;
+
+    // a directory below the root can be unreadable or deleted while it's
+    // walked. it's skipped, like the local scan skips them
+    if (!ok && (dir.empty() || pipe->failed)) {
+      walk->ok = false;
+    } else if (!ok && walk->skipped) {
+      (*walk->skipped)++;
+    }
   }
 
-  sin.sin_addr.s_addr = addr.S_un.S_addr;
+  // the last worker out lets the parked ones see that the walk is over
+  if (!walk->ok || (walk->dirs.empty() && walk->reading == 0)) {
+    remote_walk_wake(walk, walk->idle.size());
+  }
+}
 
-  if (connect(sock, (struct sockaddr *)(&sin), sizeof(struct sockaddr_in))) {
-    error_message(L"cannot connect");
-    return std::nullopt;
+// walks root over every connection in nets. returns false if the root
+// couldn't be read or a connection failed
+static bool remote_walk(RemoteWalk *walk, Net *nets, u32 count,
+                        const std::atomic<bool> *quit) {
+  walk->dirs.push_back("");
+  for (u32 i = 0; i < count; i++) {
+    for (i32 j = 0; j < REMOTE_WALK_OPEN_DIRS; j++) {
+      walk->pending++;
+      spawn(remote_walk_worker(walk, nets[i].pipe));
+    }
   }
 
-  session = libssh2_session_init();
-  if (!session) {
-    error_message(L"cannot create session");
-    return std::nullopt;
+  if (!sftp_drive(nets, count, &walk->pending, quit)) {
+    walk->ok = false;
   }
 
-  libssh2_session_set_blocking(session, 1);
-  if (libssh2_session_handshake(session, sock)) {
-    error_message(L"cannot establish ssh session");
-    return std::nullopt;
+  // after a failure workers can be left parked or yielded on a pipe that
+  // won't run again. they're resumed here and see the walk is over
+  while (walk->pending > 0) {
+    std::vector<std::coroutine_handle<>> ready;
+    for (auto &[pipe, h] : walk->idle) {
+      ready.push_back(h);
+    }
+    walk->idle.clear();
+
+    for (u32 i = 0; i < count; i++) {
+      SftpPipe *pipe = nets[i].pipe;
+      ready.insert(ready.end(), pipe->yielded.begin(), pipe->yielded.end());
+      pipe->yielded.clear();
+    }
+
+    for (auto h : ready) {
+      h.resume();
+    }
   }
 
-  auto userauthlist = libssh2_userauth_list(session, user, (u32)strlen(user));
+  return walk->ok;
+}
 
-  if (!strstr(userauthlist, "publickey")) {
-    error_message(L"server doesn't support publickey auth");
-    return std::nullopt;
+// returns false if root can't be read or the walk was stopped
+static bool local_walk(Reconcile *r, const std::string &root,
+                       std::unordered_map<std::string, ReconcileFile> *out) {
+  ScanTree tree;
+  ScanOptions opts;
+  opts.threads = std::max(std::thread::hardware_concurrency(), 1u);
+  opts.quit = &r->quit;
+  opts.found = &r->local_files;
+  if (!scan_tree(root, &tree, opts) || r->quit) {
+    return false;
   }
 
-  if (libssh2_userauth_publickey_fromfile(session, user, nullptr, priv_key,
-                                          nullptr)) {
-    error_message(L"authentication failed");
-    return std::nullopt;
+  out->reserve(tree.entries.size());
+  for (auto &entry : tree.entries) {
+    if (entry.kind == ScanKind::File) {
+      (*out)[scan_path(tree, entry)] = {entry.size, entry.mtime};
+    }
   }
+  return true;
+}
 
-  sftp = libssh2_sftp_init(session);
-  if (!sftp) {
-    error_message(L"cannot create sftp session");
-    return std::nullopt;
+// compares the local tree with the remote tree and uploads every file
+// that's missing on the remote, has a different size or is older there.
+// uploads set the remote mtime, so a tree in sync compares equal
+static void reconcile_loop(Reconcile *r, Config config,
+                           TransferPool *transfers) {
+  using LocalFiles = std::unordered_map<std::string, ReconcileFile>;
+  auto local = std::async(std::launch::async, [&]() {
+    LocalFiles files;
+    return local_walk(r, config.local_dir, &files)
+               ? std::optional<LocalFiles>(std::move(files))
+               : std::nullopt;
+  });
+
+  // connections are dialed in parallel, a walk uses the ones that came up
+  std::vector<std::future<std::optional<Net>>> dials;
+  for (u32 i = 0; i < RECONCILE_SESSIONS; i++) {
+    dials.push_back(std::async(std::launch::async, [&]() {
+      return server_dial(config.host.data(), config.user.data(),
+                         config.priv_key.data(), nullptr);
+    }));
   }
 
-  Net net;
-  net.session = session;
-  net.sftp = sftp;
-  net.sock = sock;
-  return net;
-}
+  std::vector<Net> nets;
+  for (auto &dial : dials) {
+    if (auto net = dial.get()) {
+      nets.push_back(*net);
+    }
+  }
+  defer(for (auto &net : nets) { server_disconnect(&net); });
 
-static void server_disconnect(Net *net) {
-  if (net->sftp) {
-    libssh2_sftp_shutdown(net->sftp);
+  if (nets.empty()) {
+    local.wait();
+    r->state = ReconcileState::Failed;
+    glfwPostEmptyEvent();
+    return;
   }
 
-  if (net->session) {
-    libssh2_session_disconnect(net->session, "Normal Shutdown");
-    libssh2_session_free(net->session);
+  RemoteWalk walk;
+  walk.root = config.remote_dir;
+  walk.found = &r->remote_files;
+  walk.skipped = &r->skipped;
+
+  bool ok = remote_walk(&walk, nets.data(), (u32)nets.size(), &r->quit);
+  auto local_files = local.get();
+  if (!ok || !local_files || r->quit) {
+    r->state = ReconcileState::Failed;
+    glfwPostEmptyEvent();
+    return;
   }
 
-  if (net->sock) {
-    if (shutdown(net->sock, SD_BOTH)) {
-      error_message(L"failed to shutdown socket");
-    }
+  for (auto &[rel, file] : *local_files) {
+    auto remote = walk.files.find(rel);
+    if (remote != walk.files.end() && remote->second.size == file.size) {
+      if (remote->second.mtime >= file.mtime) {
+        continue;
+      }
 
-    if (closesocket(net->sock)) {
-      error_message(L"failed to close socket");
+      // servers that round or drop mtimes still compare equal to the
+      // upload that set them
+      auto last = index_find(&transfers->index, config.remote_dir + "/" + rel);
+      if (last && last->size == file.size && last->mtime == file.mtime) {
+        continue;
+      }
     }
+
+    TransferJob job;
+    job.filename = fs::path(rel).make_preferred().string();
+    job.local = (fs::path(config.local_dir) / fs::path(rel)).string();
+    job.remote = config.remote_dir + "/" + rel;
+    transfer_enqueue(transfers, std::move(job));
+    r->queued++;
   }
 
-  net->sftp = nullptr;
-  net->session = nullptr;
-  net->sock = 0;
+  r->state = ReconcileState::Done;
+  glfwPostEmptyEvent();
 }
 
-static std::optional<std::vector<File>> read_remote_dir(LIBSSH2_SFTP *sftp,
-                                                        const char *dirname) {
-  auto sftp_handle = libssh2_sftp_open_ex(sftp, dirname, (u32)strlen(dirname),
-                                          0, 0, LIBSSH2_SFTP_OPENDIR);
-  if (!sftp_handle) {
-    return std::nullopt;
+static void reconcile_start(Reconcile *r, const Config &config,
+                            TransferPool *transfers) {
+  if (r->thread.joinable()) {
+    r->thread.join();
+  }
+
+  r->quit = false;
+  r->local_files = 0;
+  r->remote_files = 0;
+  r->queued = 0;
+  r->skipped = 0;
+  r->state = ReconcileState::Scanning;
+  r->thread = std::thread(reconcile_loop, r, config, transfers);
+}
+
+static void reconcile_stop(Reconcile *r) {
+  if (r->thread.joinable()) {
+    r->quit = true;
+    r->thread.join();
+  }
+}
+
+static void finder_loop(FileFinder *f) {
+  u32 threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  ScanTree tree;
+  ScanOptions opts;
+  opts.threads = threads;
+  opts.quit = &f->quit;
+  opts.found = &f->found;
+  if (!scan_tree(f->root, &tree, opts) || f->quit) {
+    f->state = FinderState::Failed;
+    glfwPostEmptyEvent();
+    return;
+  }
+
+  for (auto &entry : tree.entries) {
+    if (entry.kind == ScanKind::File) {
+      f->paths.push_back(scan_path(tree, entry));
+    }
   }
-  defer(libssh2_sftp_close_handle(sftp_handle));
+  std::sort(f->paths.begin(), f->paths.end());
+  finder_index_build(&f->index, f->paths);
+  f->state = FinderState::Ready;
+  glfwPostEmptyEvent();
 
-  std::vector<File> dir;
+  FinderPool pool;
+  finder_pool_start(&pool, threads);
+  defer(finder_pool_stop(&pool));
 
+  u32 done = 0;
   while (true) {
-    char buf[MAX_PATH] = {};
-    LIBSSH2_SFTP_ATTRIBUTES attrs = {};
-    i32 len = libssh2_sftp_readdir(sftp_handle, buf, array_size(buf), &attrs);
-    if (len <= 0) {
-      break;
+    std::string query;
+    u32 asked = 0;
+    {
+      std::unique_lock lock(f->mtx);
+      f->cv.wait(lock, [&]() { return f->quit || f->asked != done; });
+      if (f->quit) {
+        return;
+      }
+      query = f->query;
+      asked = f->asked;
+      f->cancel = false;
     }
+    done = asked;
 
-    if (strcmp(buf, ".") == 0 || strcmp(buf, "..") == 0) {
+    f64 start = now_seconds();
+    std::vector<FinderHit> hits;
+    if (!finder_search(f->index, &f->cache, query, FINDER_RESULTS, &pool,
+                       &f->cancel, &hits)) {
       continue;
     }
 
-    File f;
-    f.name = buf;
-
-    if (attrs.permissions & LIBSSH2_SFTP_S_IFDIR) {
-      f.kind = FileKind::Dir;
-    } else {
-      f.kind = FileKind::File;
+    {
+      std::lock_guard lock(f->mtx);
+      f->hits.swap(hits);
+      f->answered = asked;
+      f->seconds = now_seconds() - start;
     }
+    glfwPostEmptyEvent();
+  }
+}
 
-    if (attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) {
-      f.size = attrs.filesize;
+static void finder_stop(FileFinder *f) {
+  if (f->thread.joinable()) {
+    {
+      std::lock_guard lock(f->mtx);
+      f->quit = true;
+      f->cancel = true;
     }
+    f->cv.notify_one();
+    f->thread.join();
+  }
+  f->quit = false;
+}
+
+static void finder_start(FileFinder *f, const std::string &root) {
+  finder_stop(f);
+
+  f->root = root;
+  f->found = 0;
+  f->paths.clear();
+  f->index = {};
+  f->cache = {};
+  f->query.clear();
+  f->asked = 0;
+  f->answered = 0;
+  f->hits.clear();
+  f->shown.clear();
+  f->shown_for = 0;
+  f->state = FinderState::Indexing;
+  f->thread = std::thread(finder_loop, f);
+}
 
-    dir.push_back(std::move(f));
+static void finder_ask(FileFinder *f, const std::string &query) {
+  {
+    std::lock_guard lock(f->mtx);
+    f->query = query;
+    f->asked++;
+    f->cancel = true;
   }
+  f->cv.notify_one();
+}
 
-  std::sort(dir.begin(), dir.end(),
-            [](auto &lhs, auto &rhs) { return lhs.name < rhs.name; });
+// shows the file's directory in the local panel, filtered down to the file
+static void finder_open(App *app, Config *config, u32 id) {
+  FileFinder *f = &app->finder;
+  fs::path path = fs::path(f->root) / f->paths[id];
+  change_local_dir(app, config, path.parent_path().string());
 
-  return dir;
+  ImGuiTextFilter *filter = &app->local_view.filter;
+  snprintf(filter->InputBuf, array_size(filter->InputBuf), "%s",
+           path.filename().string().data());
+  filter->Build();
 }
 
-static void change_local_dir(App *app, Config *config,
-                             const std::string &path) {
-  config->local_dir = path;
-  app->local_working_dir.clear();
+static void finder_draw(App *app, Config *config) {
+  FileFinder *f = &app->finder;
 
-  for (auto &e : fs::directory_iterator(path)) {
-    File f;
-    f.name = e.path().filename().string();
+  auto center = ImGui::GetMainViewport()->GetCenter();
+  ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
+  ImGui::SetNextWindowSize(ImVec2(600, 400), ImGuiCond_Appearing);
+  if (!ImGui::BeginPopupModal("go to file")) {
+    return;
+  }
 
-    if (e.is_directory()) {
-      f.kind = FileKind::Dir;
-    } else {
-      f.kind = FileKind::File;
+  if (ImGui::IsWindowAppearing()) {
+    ImGui::SetKeyboardFocusHere();
+  }
+  ImGui::SetNextItemWidth(-FLT_MIN);
+  if (ImGui::InputText("##query", &f->input)) {
+    finder_ask(f, f->input);
+  }
+
+  {
+    std::lock_guard lock(f->mtx);
+    if (f->shown_for != f->answered) {
+      f->shown_for = f->answered;
+      f->shown = f->hits;
+      f->selected = 0;
     }
+  }
+
+  switch (f->state) {
+  case FinderState::Indexing:
+    ImGui::TextDisabled("indexing %s, %d files so far", f->root.data(),
+                        (i32)f->found);
+    break;
+  case FinderState::Ready:
+    ImGui::TextDisabled("%d files, %d shown, found in %.1f ms",
+                        (i32)f->paths.size(), (i32)f->shown.size(),
+                        f->seconds * 1000);
+    break;
+  case FinderState::Failed:
+    ImGui::Text("failed to read %s", f->root.data());
+    break;
+  default: break;
+  }
 
-    f.size = e.file_size();
+  i32 count = (i32)f->shown.size();
+  if (ImGui::IsKeyPressed(ImGuiKey_DownArrow)) {
+    f->selected = std::min(f->selected + 1, count - 1);
+  }
+  if (ImGui::IsKeyPressed(ImGuiKey_UpArrow)) {
+    f->selected = std::max(f->selected - 1, 0);
+  }
 
-    app->local_working_dir.push_back(std::move(f));
+  i32 open = -1;
+  if (ImGui::IsKeyPressed(ImGuiKey_Enter) && f->selected < count) {
+    open = f->selected;
   }
 
-  write_config(*config);
+  if (ImGui::BeginChild("finder results", ImGui::GetContentRegionAvail())) {
+    ImGuiListClipper clipper;
+    clipper.Begin(count);
+    while (clipper.Step()) {
+      for (i32 row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+        auto &path = f->paths[f->shown[row].id];
+        if (ImGui::Selectable(path.data(), row == f->selected)) {
+          open = row;
+        }
+      }
+    }
+  }
+  ImGui::EndChild();
+
+  if (open >= 0) {
+    finder_open(app, config, f->shown[open].id);
+    ImGui::CloseCurrentPopup();
+  } else if (ImGui::IsKeyPressed(ImGuiKey_Escape)) {
+    ImGui::CloseCurrentPopup();
+  }
+
+  ImGui::EndPopup();
 }
 
-static void change_remote_dir(App *app, Config *config, Net *net,
-                              const std::string &path) {
-  auto list = read_remote_dir(net->sftp, path.data());
-  if (list) {
-    config->remote_dir = path;
-    app->remote_working_dir = *std::move(list);
-    write_config(*config);
-  } else {
-    error_message(L"failed to read remote dir");
+// draws the filter and the visible rows. returns the entry of a directory
+// that was clicked, or -1
+static i32 file_view_draw(FileView *view, const FileList &files, u32 version,
+                          const char *id) {
+  bool changed = view->filter.Draw();
+  if (changed || view->version != version) {
+    std::string_view query = view->filter.InputBuf;
+
+    // while typing more of a term, only the rows that passed before can
+    // pass now
+    bool narrow = view->version == version && match_narrows(view->query, query);
+    view->version = version;
+    view->query = query;
+
+    auto terms = match_parse(query);
+    u32 count = file_list_size(files);
+    if (terms.empty()) {
+      view->rows.resize(count);
+      for (u32 i = 0; i < count; i++) {
+        view->rows[i] = i;
+      }
+    } else {
+      if (view->indexed != version) {
+        view->indexed = version;
+        match_index_clear(&view->index);
+        for (u32 entry : files.order) {
+          match_index_add(&view->index, file_list_name(files, entry));
+        }
+        match_index_finish(&view->index);
+      }
+      match_filter(view->index, terms, narrow ? &view->rows : nullptr,
+                   &view->rows);
+    }
+  }
+
+  i32 clicked = -1;
+  if (ImGui::BeginChild(id, ImGui::GetContentRegionAvail())) {
+    ImGuiListClipper clipper;
+    clipper.Begin((i32)view->rows.size());
+    while (clipper.Step()) {
+      for (i32 row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+        u32 entry = files.order[view->rows[row]];
+        const char *name = file_list_name(files, entry).data();
+
+        if (files.kinds[entry] == FileKind::Dir) {
+          if (ImGui::Selectable(name)) {
+            clicked = (i32)entry;
+          }
+        } else {
+          ImGui::PushStyleColor(ImGuiCol_Text, 0xffaaaaaa);
+          ImGui::Selectable(name);
+          ImGui::PopStyleColor();
+        }
+      }
+    }
   }
+  ImGui::EndChild();
+
+  return clicked;
 }
 
-static bool upload_file(Config *config, Net *net, const fs::path &filename) {
-  auto remote = config->remote_dir + "/" + filename.generic_string();
+// a frame of a spinning bar, for work with no progress to show
+static char spinner() { return "|/-\\"[(i32)(ImGui::GetTime() * 4) % 4]; }
 
-  auto sftp_handle = libssh2_sftp_open_ex(
-      net->sftp, remote.data(), (u32)remote.size(),
-      LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
-      LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR | LIBSSH2_SFTP_S_IRGRP |
-          LIBSSH2_SFTP_S_IROTH,
-      LIBSSH2_SFTP_OPENFILE);
-  if (!sftp_handle) {
-    return false;
+// a reconcile can start tens of thousands of uploads, only the latest
+// lines are kept
+constexpr u64 WATCHER_LOG_LINES = 4096;
+
+static void log_line(App *app, std::string line) {
+  app->watcher_log.push_back(std::move(line));
+  if (app->watcher_log.size() > WATCHER_LOG_LINES) {
+    app->watcher_log.pop_front();
   }
-  defer(libssh2_sftp_close_handle(sftp_handle));
+}
 
-  auto file_contents = read_entire_file(
-      (config->local_dir / fs::path(filename)).string().data());
-  if (!file_contents) {
-    return false;
+// takes in what the transfer threads finished since the last frame. done
+// every frame, whether or not the watcher window is shown. patching a large
+// listing sorts it, so that's done after the lock is let go
+static void transfers_collect(App *app, Config *config,
+                              TransferPool *transfers) {
+  std::vector<TransferResult> results;
+  {
+    std::lock_guard lock(transfers->mtx);
+    results.swap(transfers->results);
   }
 
-  u64 len = file_contents->size();
-  char *ptr = file_contents->data();
-  while (true) {
-    i64 read = libssh2_sftp_write(sftp_handle, ptr, len);
+  for (auto &result : results) {
+    if (result.ok) {
+      remote_cache_patch(app, *config, result);
+    }
 
-    if (read < 0) {
-      return false;
+    if (result.job.changed_at != 0) {
+      LatencyStats &stats = app->upload_latency;
+      stats.last = result.latency;
+      stats.max = std::max(stats.max, result.latency);
+      stats.total += result.latency;
+      stats.count++;
     }
 
-    if (read == 0) {
-      return true;
+    char line[512];
+    if (result.unchanged) {
+      snprintf(line, array_size(line), "%s: unchanged, not uploaded",
+               result.job.filename.data());
+    } else if (result.ok) {
+      snprintf(line, array_size(line), "%s: uploaded in %.2fs",
+               result.job.filename.data(), result.seconds);
+    } else {
+      snprintf(line, array_size(line), "%s: upload failed",
+               result.job.filename.data());
     }
+    log_line(app, line);
+  }
+}
 
-    ptr += read;
-    len -= read;
+// logs the changes the watcher thread started uploads for
+static void watch_collect(App *app, WatchThread *watcher) {
+  FileChange change;
+  while (change_queue_pop(&watcher->uploads, &change)) {
+    log_line(app, change.filename + ": modified");
   }
 }
 
 static void app_update(App *app, Config *config, Net *net,
-                       FileWatcher *watcher) {
+                       WatchThread *watcher, TransferPool *transfers) {
   ImGui::DockSpaceOverViewport(ImGui::GetMainViewport(),
                                ImGuiDockNodeFlags_PassthruCentralNode);
 
@@ -546,6 +3670,10 @@ static void app_update(App *app, Config *config, Net *net,
     ImGui::OpenPopup("connect");
   }
 
+  listing_update(app, config);
+  watch_collect(app, watcher);
+  transfers_collect(app, config, transfers);
+
   auto center = ImGui::GetMainViewport()->GetCenter();
   ImGui::SetNextWindowPos(center, ImGuiCond_Appearing, ImVec2(0.5f, 0.5f));
   if (ImGui::BeginPopupModal("connect", nullptr,
@@ -563,17 +3691,34 @@ static void app_update(App *app, Config *config, Net *net,
       }
     }
 
+    bool dialing = app->dial.valid();
+    if (dialing) {
+      ImGui::BeginDisabled();
+    }
     if (ImGui::Button(ICON_FA_LINK " connect", ImVec2(120, 0))) {
-      auto connect = server_connect(config->host.data(), config->user.data(),
-                                    config->priv_key.data());
-      if (connect) {
-        *net = *connect;
+      app->dial = std::async(std::launch::async, server_dial_config, *config);
+    }
+    if (dialing) {
+      ImGui::EndDisabled();
+    }
+
+    using namespace std::chrono;
+    if (dialing &&
+        app->dial.wait_for(seconds(0)) == std::future_status::ready) {
+      ServerDial d = app->dial.get();
+      if (d.net) {
+        *net = *d.net;
         write_config(*config);
+        transfer_start(transfers, *config);
+        reconcile_start(&app->reconcile, *config, transfers);
+        listing_start(&app->remote_listing, net, *config);
 
         change_local_dir(app, config, config->local_dir);
-        change_remote_dir(app, config, net, config->remote_dir);
+        change_remote_dir(app, config, config->remote_dir);
 
         ImGui::CloseCurrentPopup();
+      } else {
+        error_message(d.error);
       }
     }
     ImGui::SetItemDefaultFocus();
@@ -581,6 +3726,11 @@ static void app_update(App *app, Config *config, Net *net,
     if (ImGui::Button(ICON_FA_TIMES " exit", ImVec2(120, 0))) {
       glfwSetWindowShouldClose(app->window, 1);
     }
+
+    if (app->dial.valid()) {
+      ImGui::TextDisabled("%c connecting to %s", spinner(),
+                          config->host.data());
+    }
     ImGui::EndPopup();
   }
 
@@ -588,6 +3738,22 @@ static void app_update(App *app, Config *config, Net *net,
     ImGui::ShowDemoWindow(&app->show_demo);
   }
 
+  // the tree is indexed again when the palette is opened outside of it
+  auto &io = ImGui::GetIO();
+  if (io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_P) && !watcher->running()) {
+    FileFinder *f = &app->finder;
+    auto rel = fs::path(config->local_dir).lexically_relative(f->root);
+    if (f->state == FinderState::Idle || f->state == FinderState::Failed ||
+        rel.empty() || *rel.begin() == "..") {
+      finder_start(f, config->local_dir);
+    }
+
+    f->input.clear();
+    finder_ask(f, "");
+    ImGui::OpenPopup("go to file");
+  }
+  finder_draw(app, config);
+
   if (ImGui::Begin("local")) {
     if (watcher->running()) {
       ImGui::BeginDisabled();
@@ -618,29 +3784,13 @@ static void app_update(App *app, Config *config, Net *net,
       change_local_dir(app, config, str);
     }
 
-    static ImGuiTextFilter s_filter;
-    s_filter.Draw();
-
-    if (ImGui::BeginChild("local files", ImGui::GetContentRegionAvail())) {
-      for (auto &file : app->local_working_dir) {
-        if (!s_filter.PassFilter(file.name.data())) {
-          continue;
-        }
-
-        if (file.kind == FileKind::Dir) {
-          if (ImGui::Selectable(file.name.data())) {
-            auto path = (config->local_dir / fs::path(file.name)).string();
-            change_local_dir(app, config, path);
-            break; // change_local_dir invalidates iterator
-          }
-        } else {
-          ImGui::PushStyleColor(ImGuiCol_Text, 0xffaaaaaa);
-          ImGui::Selectable(file.name.data());
-          ImGui::PopStyleColor();
-        }
-      }
+    i32 clicked = file_view_draw(&app->local_view, app->local_working_dir,
+                                 app->local_version, "local files");
+    if (clicked >= 0) {
+      auto name = file_list_name(app->local_working_dir, clicked);
+      auto path = (config->local_dir / fs::path(name)).string();
+      change_local_dir(app, config, path);
     }
-    ImGui::EndChild();
 
     if (watcher->running()) {
       ImGui::EndDisabled();
@@ -667,7 +3817,7 @@ static void app_update(App *app, Config *config, Net *net,
         ImGui::InputText("directory", &s_remote_dir);
 
         if (ImGui::Button("ok", ImVec2(120, 0))) {
-          change_remote_dir(app, config, net, s_remote_dir);
+          change_remote_dir(app, config, s_remote_dir);
           ImGui::CloseCurrentPopup();
         }
 
@@ -686,8 +3836,24 @@ static void app_update(App *app, Config *config, Net *net,
 
     ImGui::Text("remote dir: %s", config->remote_dir.data());
 
+    // the last directory stays on screen until the new one has entries
+    RemoteListing *l = &app->remote_listing;
+    if (l->settled != l->asked && l->revalidating) {
+      ImGui::SameLine();
+      ImGui::TextDisabled("%c checking for changes, %d entries so far",
+                          spinner(), (i32)file_list_size(l->fresh));
+    } else if (l->settled != l->asked) {
+      i32 entries = 0;
+      if (l->shown == l->asked) {
+        entries = (i32)file_list_size(app->remote_working_dir);
+      }
+      ImGui::SameLine();
+      ImGui::TextDisabled("%c listing %s, %d entries so far", spinner(),
+                          l->wanted.data(), entries);
+    }
+
     if (ImGui::Button(ICON_FA_REFRESH " refresh")) {
-      change_remote_dir(app, config, net, config->remote_dir);
+      change_remote_dir(app, config, config->remote_dir);
     }
 
     ImGui::SameLine();
@@ -695,33 +3861,16 @@ static void app_update(App *app, Config *config, Net *net,
     if (ImGui::Button(ICON_FA_LONG_ARROW_UP " up one")) {
       u64 i = config->remote_dir.find_last_of('/');
       if (i != std::string::npos) {
-        change_remote_dir(app, config, net, config->remote_dir.substr(0, i));
+        change_remote_dir(app, config, config->remote_dir.substr(0, i));
       }
     }
 
-    static ImGuiTextFilter s_filter;
-    s_filter.Draw();
-
-    if (ImGui::BeginChild("remote files", ImGui::GetContentRegionAvail())) {
-      for (auto &file : app->remote_working_dir) {
-        if (!s_filter.PassFilter(file.name.data())) {
-          continue;
-        }
-
-        if (file.kind == FileKind::Dir) {
-          if (ImGui::Selectable(file.name.data())) {
-            change_remote_dir(app, config, net,
-                              config->remote_dir + "/" + file.name);
-            break;
-          }
-        } else {
-          ImGui::PushStyleColor(ImGuiCol_Text, 0xffaaaaaa);
-          ImGui::Selectable(file.name.data());
-          ImGui::PopStyleColor();
-        }
-      }
+    i32 clicked = file_view_draw(&app->remote_view, app->remote_working_dir,
+                                 app->remote_version, "remote files");
+    if (clicked >= 0) {
+      std::string name(file_list_name(app->remote_working_dir, clicked));
+      change_remote_dir(app, config, config->remote_dir + "/" + name);
     }
-    ImGui::EndChild();
 
     if (watcher->running()) {
       ImGui::EndDisabled();
@@ -732,14 +3881,14 @@ static void app_update(App *app, Config *config, Net *net,
   if (ImGui::Begin("watcher")) {
     if (!watcher->running()) {
       if (ImGui::Button(ICON_FA_PLAY " start")) {
-        watcher_init(watcher, config->local_dir);
-        app->watcher_log.push_back(config->local_dir +
-                                   ": watching for changes");
+        if (watch_start(watcher, *config, transfers)) {
+          log_line(app, config->local_dir + ": watching for changes");
+        }
       }
     } else {
       if (ImGui::Button(ICON_FA_STOP " stop")) {
-        watcher_destroy(watcher);
-        app->watcher_log.push_back("stopped file watcher");
+        watch_stop(watcher);
+        log_line(app, "stopped file watcher");
       }
     }
 
@@ -749,9 +3898,64 @@ static void app_update(App *app, Config *config, Net *net,
       app->watcher_log.clear();
     }
 
+    switch (app->reconcile.state) {
+    case ReconcileState::Scanning:
+      ImGui::Text("reconcile: scanning, %d local and %d remote files",
+                  (i32)app->reconcile.local_files,
+                  (i32)app->reconcile.remote_files);
+      break;
+    case ReconcileState::Done:
+      ImGui::Text("reconcile: %d of %d files out of date",
+                  (i32)app->reconcile.queued, (i32)app->reconcile.local_files);
+      if (i32 skipped = app->reconcile.skipped) {
+        ImGui::Text("%d remote directories couldn't be read", skipped);
+      }
+      break;
+    case ReconcileState::Failed: ImGui::Text("reconcile: failed"); break;
+    default: break;
+    }
+
+    if (i32 settled = watcher->settled) {
+      i32 events = watcher->events;
+      ImGui::Text("coalesced %d changes into %d (%.1f:1)", events, settled,
+                  (f32)events / settled);
+    }
+
+    if (i32 overflows = watcher->overflows) {
+      ImGui::Text("change buffer overflowed %d times, rescanned", overflows);
+    }
+
+    {
+      std::lock_guard lock(transfers->mtx);
+      ImGui::Text("uploads: %d queued, %d active, %d/%d sessions, "
+                  "%d standby",
+                  (i32)transfers->queue.size(), transfers->active,
+                  transfers->connected,
+                  transfers->connected + (i32)transfers->missing,
+                  (i32)transfers->spare.size());
+
+      if (i32 reconnects = transfers->reconnects) {
+        ImGui::Text("reconnected %d times", reconnects);
+      }
+
+      if (u32 failures = transfers->dial_failures) {
+        ImGui::Text("cannot reach server, %u attempts failed", failures);
+      }
+    }
+
+    if (LatencyStats &stats = app->upload_latency; stats.count > 0) {
+      ImGui::Text("change to upload: %.1f ms last, %.1f ms avg, %.1f ms max",
+                  stats.last * 1000, stats.total / stats.count * 1000,
+                  stats.max * 1000);
+    }
+
     if (ImGui::BeginChild("watcher log", ImGui::GetContentRegionAvail())) {
-      for (auto &line : app->watcher_log) {
-        ImGui::TextUnformatted(line.data());
+      ImGuiListClipper clipper;
+      clipper.Begin((i32)app->watcher_log.size());
+      while (clipper.Step()) {
+        for (i32 row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+          ImGui::TextUnformatted(app->watcher_log[row].data());
+        }
       }
 
       if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
@@ -761,26 +3965,11 @@ static void app_update(App *app, Config *config, Net *net,
     ImGui::EndChild();
   }
   ImGui::End();
-
-  watcher_poll(watcher);
-  for (auto &change : watcher->changes) {
-    switch (change.type) {
-    case FILE_ACTION_MODIFIED:
-      auto local = config->local_dir / fs::path(change.filename);
-      if (fs::is_regular_file(local)) {
-        i64 modified = fs::last_write_time(local).time_since_epoch().count();
-        if (watcher->modtimes[change.filename] < modified) {
-          watcher->modtimes[change.filename] = modified;
-          app->watcher_log.push_back(change.filename + ": modified");
-          upload_file(config, net, change.filename);
-        }
-      }
-      break;
-    }
-  }
 }
 
-#if 0
+#if !defined(_WIN32)
+int main(int, char **)
+#elif 0
 #pragma comment(linker, "/subsystem:console")
 int main(int, char **)
 #else
@@ -905,11 +4094,16 @@ int WINAPI WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int)
   style.LogSliderDeadzone = 4;
   style.TabRounding = 4;
 
+#ifdef _WIN32
   WSADATA wsadata;
   i32 wsa_error = WSAStartup(MAKEWORD(2, 0), &wsadata);
   if (wsa_error) {
     exit(1);
   }
+#else
+  // a dropped connection shouldn't kill the process
+  signal(SIGPIPE, SIG_IGN);
+#endif
 
   i32 ssh2_error = libssh2_init(0);
   if (ssh2_error) {
@@ -924,7 +4118,9 @@ int WINAPI WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int)
 
   Net net;
 
-  FileWatcher watcher;
+  WatchThread watcher;
+
+  TransferPool transfers;
 
   while (!glfwWindowShouldClose(window)) {
     glfwWaitEventsTimeout(0.25);
@@ -933,7 +4129,7 @@ int WINAPI WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int)
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
-    app_update(&app, &config, &net, &watcher);
+    app_update(&app, &config, &net, &watcher, &transfers);
 
     ImGui::Render();
     i32 width, height;
@@ -953,6 +4149,12 @@ int WINAPI WinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int)
     glfwSwapBuffers(window);
   }
 
+  watch_stop(&watcher);
+  reconcile_stop(&app.reconcile);
+  finder_stop(&app.finder);
+  transfer_stop(&transfers);
+  listing_stop(&app.remote_listing);
+
   if (net.session) {
     server_disconnect(&net);
   }
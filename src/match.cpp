@@ -0,0 +1,258 @@
+#include "match.h"
+#include "hash.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MATCH_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define MATCH_AVX2
+#else
+#define MATCH_AVX2 __attribute__((target("avx2")))
+#endif
+
+// the kernels read up to this far past the end of the text
+constexpr u64 MATCH_PADDING = 64;
+
+static char fold(char c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; }
+
+static u32 lowest_bit(u32 mask) {
+#ifdef _MSC_VER
+  unsigned long i = 0;
+  _BitScanForward(&i, mask);
+  return (u32)i;
+#else
+  return (u32)__builtin_ctz(mask);
+#endif
+}
+
+// first occurrence of needle in hay[0, n), or n. both are folded already.
+// candidates are positions where the first and the last byte of the needle
+// match, the middle is only compared for those
+[[maybe_unused]] static u64 find_scalar(const char *hay, u64 n,
+                                        const char *needle, u64 k) {
+  for (u64 i = 0; i + k <= n; i++) {
+    if (hay[i] == needle[0] && hay[i + k - 1] == needle[k - 1] &&
+        memcmp(hay + i, needle, k) == 0) {
+      return i;
+    }
+  }
+  return n;
+}
+
+#ifdef MATCH_X64
+static u64 find_sse2(const char *hay, u64 n, const char *needle, u64 k) {
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[k - 1]);
+
+  for (u64 i = 0; i + k <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + k - 1));
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                               _mm_cmpeq_epi8(b, last));
+
+    u32 mask = (u32)_mm_movemask_epi8(eq);
+    while (mask) {
+      u64 pos = i + lowest_bit(mask);
+      if (pos + k > n) {
+        return n;
+      }
+      if (memcmp(hay + pos + 1, needle + 1, k - 1) == 0) {
+        return pos;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return n;
+}
+
+MATCH_AVX2 static u64 find_avx2(const char *hay, u64 n, const char *needle,
+                                u64 k) {
+  __m256i first = _mm256_set1_epi8(needle[0]);
+  __m256i last = _mm256_set1_epi8(needle[k - 1]);
+
+  for (u64 i = 0; i + k <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + k - 1));
+    __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                  _mm256_cmpeq_epi8(b, last));
+
+    u32 mask = (u32)_mm256_movemask_epi8(eq);
+    while (mask) {
+      u64 pos = i + lowest_bit(mask);
+      if (pos + k > n) {
+        return n;
+      }
+      if (memcmp(hay + pos + 1, needle + 1, k - 1) == 0) {
+        return pos;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return n;
+}
+#endif
+
+struct MatchKernel {
+  const char *name;
+  u64 (*find)(const char *hay, u64 n, const char *needle, u64 k);
+};
+
+static const MatchKernel &match_kernel_get() {
+  static const MatchKernel kernel = []() -> MatchKernel {
+#ifdef MATCH_X64
+    if (cpu_has_avx2()) {
+      return {"avx2", find_avx2};
+    }
+    return {"sse2", find_sse2};
+#else
+    return {"scalar", find_scalar};
+#endif
+  }();
+  return kernel;
+}
+
+const char *match_kernel() { return match_kernel_get().name; }
+
+void match_index_clear(MatchIndex *index) {
+  index->text.clear();
+  index->starts.clear();
+}
+
+void match_index_add(MatchIndex *index, std::string_view name) {
+  index->starts.push_back((u32)index->text.size());
+  for (char c : name) {
+    index->text.push_back(fold(c));
+  }
+  index->text.push_back(0);
+}
+
+void match_index_finish(MatchIndex *index) {
+  index->starts.push_back((u32)index->text.size());
+  index->text.append(MATCH_PADDING, 0);
+}
+
+std::vector<MatchTerm> match_parse(std::string_view query) {
+  std::vector<MatchTerm> terms;
+  while (!query.empty()) {
+    u64 comma = query.find(',');
+    std::string_view part = query.substr(0, comma);
+    query = comma == std::string_view::npos ? "" : query.substr(comma + 1);
+
+    while (!part.empty() && (part.front() == ' ' || part.front() == '\t')) {
+      part.remove_prefix(1);
+    }
+    while (!part.empty() && (part.back() == ' ' || part.back() == '\t')) {
+      part.remove_suffix(1);
+    }
+
+    MatchTerm term;
+    if (!part.empty() && part.front() == '-') {
+      term.exclude = true;
+      part.remove_prefix(1);
+    }
+    if (part.empty()) {
+      continue;
+    }
+
+    for (char c : part) {
+      term.text.push_back(fold(c));
+    }
+    terms.push_back(std::move(term));
+  }
+  return terms;
+}
+
+bool match_narrows(std::string_view from, std::string_view to) {
+  auto a = match_parse(from);
+  auto b = match_parse(to);
+
+  // typing more of a single term is the common case
+  return a.size() == 1 && b.size() == 1 && !a[0].exclude && !b[0].exclude &&
+         b[0].text.find(a[0].text) != std::string::npos;
+}
+
+// marks every row containing the term with one pass over the whole text
+static void match_term_all(const MatchIndex &index, const MatchTerm &term,
+                           std::vector<u8> *hits) {
+  auto find = match_kernel_get().find;
+  const char *text = index.text.data();
+  u64 end = index.starts.back();
+  u64 k = term.text.size();
+
+  u64 pos = 0;
+  u32 row = 0;
+  while (pos < end) {
+    u64 at = pos + find(text + pos, end - pos, term.text.data(), k);
+    if (at >= end) {
+      break;
+    }
+
+    // names can't contain the 0 separators, neither can a match
+    while (index.starts[row + 1] <= at) {
+      row++;
+    }
+    (*hits)[row] = 1;
+    pos = index.starts[row + 1];
+  }
+}
+
+static bool match_term_row(const MatchIndex &index, const MatchTerm &term,
+                           u32 row) {
+  u64 begin = index.starts[row];
+  u64 n = index.starts[row + 1] - 1 - begin;
+  auto find = match_kernel_get().find;
+  return find(index.text.data() + begin, n, term.text.data(),
+              term.text.size()) < n;
+}
+
+void match_filter(const MatchIndex &index, const std::vector<MatchTerm> &terms,
+                  const std::vector<u32> *within, std::vector<u32> *rows) {
+  u32 count = match_index_rows(index);
+  bool has_include = false;
+  for (auto &term : terms) {
+    has_include |= !term.exclude;
+  }
+
+  std::vector<u32> result;
+  if (within) {
+    for (u32 row : *within) {
+      bool pass = !has_include;
+      for (auto &term : terms) {
+        if (match_term_row(index, term, row)) {
+          pass = !term.exclude;
+          break;
+        }
+      }
+      if (pass) {
+        result.push_back(row);
+      }
+    }
+  } else {
+    std::vector<std::vector<u8>> hits(terms.size());
+    for (u64 i = 0; i < terms.size(); i++) {
+      hits[i].resize(count);
+      match_term_all(index, terms[i], &hits[i]);
+    }
+
+    for (u32 row = 0; row < count; row++) {
+      bool pass = !has_include;
+      for (u64 i = 0; i < terms.size(); i++) {
+        if (hits[i][row]) {
+          pass = !terms[i].exclude;
+          break;
+        }
+      }
+      if (pass) {
+        result.push_back(row);
+      }
+    }
+  }
+
+  rows->swap(result);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "language.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the names of a listing folded to lower case and packed into one buffer,
+// so a query is one pass of a simd substring search over all of them
+struct MatchIndex {
+  std::string text;        // names, each followed by a 0, then padding
+  std::vector<u32> starts; // offset of every name and one past the last
+};
+
+void match_index_clear(MatchIndex *index);
+void match_index_add(MatchIndex *index, std::string_view name);
+void match_index_finish(MatchIndex *index);
+
+inline u32 match_index_rows(const MatchIndex &index) {
+  return index.starts.empty() ? 0 : (u32)index.starts.size() - 1;
+}
+
+// one comma separated part of a query. like ImGuiTextFilter, a leading -
+// excludes names containing the rest, and the first term that hits a name
+// decides whether it passes
+struct MatchTerm {
+  std::string text; // folded
+  bool exclude = false;
+};
+
+std::vector<MatchTerm> match_parse(std::string_view query);
+
+// true if to is known to pass only names that from passes, so the rows
+// found for from can be searched instead of the whole listing
+bool match_narrows(std::string_view from, std::string_view to);
+
+// rows passing the query, in order. within limits the search to rows
+// known to be a superset of the result
+void match_filter(const MatchIndex &index, const std::vector<MatchTerm> &terms,
+                  const std::vector<u32> *within, std::vector<u32> *rows);
+
+// name of the kernel picked for this cpu: "avx2", "sse2" or "scalar"
+const char *match_kernel();
@@ -0,0 +1,143 @@
+#include "reader.h"
+#include <algorithm>
+
+static void read_loop(ReadThread *t) {
+  std::unique_lock lock(t->mtx);
+  while (true) {
+    t->cv.wait(lock, [&] { return t->quit || !t->queue.empty(); });
+    if (t->queue.empty()) {
+      return;
+    }
+
+    ChunkRead *read = t->queue.front();
+    t->queue.pop_front();
+    lock.unlock();
+
+    read->len = (u64)fread(read->dst, 1, read->size, read->fp);
+    read->ready.store(true, std::memory_order_release);
+    if (t->done) {
+      t->done(t->ctx);
+    }
+
+    lock.lock();
+    t->read_cv.notify_all();
+  }
+}
+
+void read_thread_start(ReadThread *t, void (*done)(void *ctx), void *ctx) {
+  t->quit = false;
+  t->done = done;
+  t->ctx = ctx;
+  t->thread = std::thread(read_loop, t);
+}
+
+// reads queued before stop are still done, readers wait on them to close
+void read_thread_stop(ReadThread *t) {
+  {
+    std::lock_guard lock(t->mtx);
+    t->quit = true;
+  }
+  t->cv.notify_one();
+  if (t->thread.joinable()) {
+    t->thread.join();
+  }
+}
+
+static void reader_fetch(ChunkReader *r, i32 i) {
+  r->chunks[i].resize(r->chunk_size);
+
+  ChunkRead *read = &r->next;
+  read->fp = r->fp;
+  read->dst = r->chunks[i].data();
+  read->size = r->chunk_size;
+  read->len = 0;
+  read->ready = false;
+  r->reading = true;
+
+  ReadThread *t = r->thread;
+  {
+    std::lock_guard lock(t->mtx);
+    t->queue.push_back(read);
+  }
+  t->cv.notify_one();
+}
+
+bool reader_open(ChunkReader *r, ReadThread *thread, const std::string &path,
+                 u64 chunk_size) {
+#ifdef _WIN32
+  if (fopen_s(&r->fp, path.data(), "rb")) {
+    return false;
+  }
+#else
+  r->fp = fopen(path.data(), "rb");
+  if (!r->fp) {
+    return false;
+  }
+#endif
+
+  r->thread = thread;
+  r->chunk_size = chunk_size;
+  r->front = 1;
+  reader_fetch(r, 0);
+  return true;
+}
+
+u64 reader_peek(ChunkReader *r, const char **data, u64 max) {
+  if (r->pos == r->len) {
+    if (!r->reading) {
+      r->eof = true;
+      return 0;
+    }
+
+    if (!r->next.ready.load(std::memory_order_acquire)) {
+      return 0;
+    }
+
+    r->reading = false;
+    r->len = r->next.len;
+    r->pos = 0;
+    r->front ^= 1;
+    if (ferror(r->fp)) {
+      r->failed = true;
+    }
+
+    if (r->len == r->chunk_size) {
+      reader_fetch(r, r->front ^ 1);
+    }
+
+    if (r->len == 0) {
+      r->eof = true;
+      return 0;
+    }
+  }
+
+  *data = &r->chunks[r->front][r->pos];
+  return std::min(max, r->len - r->pos);
+}
+
+void reader_close(ChunkReader *r) {
+  // the read thread may still be writing into the buffer
+  if (r->reading) {
+    ReadThread *t = r->thread;
+    std::unique_lock lock(t->mtx);
+    t->read_cv.wait(lock, [&] {
+      return r->next.ready.load(std::memory_order_acquire);
+    });
+  }
+
+  if (r->fp) {
+    fclose(r->fp);
+  }
+
+  r->thread = nullptr;
+  r->fp = nullptr;
+  r->chunk_size = 0;
+  r->chunks[0] = {};
+  r->chunks[1] = {};
+  r->front = 0;
+  r->len = 0;
+  r->pos = 0;
+  r->reading = false;
+  r->eof = false;
+  r->failed = false;
+}
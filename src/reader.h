@@ -0,0 +1,63 @@
+#pragma once
+
+#include "language.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// one chunk a reader has asked its read thread for
+struct ChunkRead {
+  FILE *fp = nullptr;
+  char *dst = nullptr;
+  u64 size = 0;
+  u64 len = 0; // read, set before ready
+  std::atomic<bool> ready = false;
+};
+
+// a thread that does the reads of many chunk readers in turn, so reading
+// a chunk doesn't start a thread. done is called after every read, from
+// the read thread, to wake whoever waits on the readers
+struct ReadThread {
+  std::thread thread;
+  std::mutex mtx;
+  std::condition_variable cv;      // wakes the thread
+  std::condition_variable read_cv; // a read finished
+  std::deque<ChunkRead *> queue;
+  bool quit = false;
+  void (*done)(void *ctx) = nullptr;
+  void *ctx = nullptr;
+};
+
+void read_thread_start(ReadThread *t, void (*done)(void *ctx), void *ctx);
+void read_thread_stop(ReadThread *t);
+
+// reads a file in fixed-size chunks. the next chunk is read on the read
+// thread while the current one is being sent. a reader must not move
+// while it's open
+struct ChunkReader {
+  ReadThread *thread = nullptr;
+  FILE *fp = nullptr;
+  u64 chunk_size = 0;
+  std::vector<char> chunks[2];
+  i32 front = 0;
+  u64 len = 0;
+  u64 pos = 0; // advanced by the caller past the bytes it used
+  ChunkRead next;
+  bool reading = false; // next is queued or being read
+  bool eof = false;
+  bool failed = false;
+};
+
+bool reader_open(ChunkReader *r, ReadThread *thread, const std::string &path,
+                 u64 chunk_size);
+
+// points data at the next unused bytes of the file. returns 0 if the file
+// is done (eof is set) or the next chunk is still being read
+u64 reader_peek(ChunkReader *r, const char **data, u64 max);
+
+void reader_close(ChunkReader *r);
@@ -0,0 +1,350 @@
+#include "scan.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+struct ScanJob {
+  std::string path;
+  u32 id = 0;
+};
+
+// each worker takes jobs from the back of its own deque and steals from
+// the front of the others', so thieves take the oldest, shallowest
+// directories, which tend to have the most below them
+struct ScanWorker {
+  std::mutex mtx;
+  std::deque<ScanJob> jobs;
+  ScanTree out; // entries found by this worker, ids are global
+  std::vector<std::pair<u32, u32>> dirs; // directory id, local entry index
+  std::vector<char> buf;
+};
+
+struct ScanPool {
+  std::vector<std::unique_ptr<ScanWorker>> workers;
+  std::atomic<i64> pending = 0; // jobs queued or being read
+  std::atomic<u32> next_id = 1;
+  ScanOptions opts;
+
+  // workers with nothing to steal wait here instead of spinning. queued
+  // counts every job pushed, so a parked worker can tell it missed one
+  std::mutex idle_mtx;
+  std::condition_variable idle_cv;
+  std::atomic<u64> queued = 0;
+  std::atomic<i32> parked = 0;
+};
+
+static void scan_wake(ScanPool *pool, bool all) {
+  if (pool->parked == 0) {
+    return;
+  }
+
+  std::lock_guard lock(pool->idle_mtx);
+  if (all) {
+    pool->idle_cv.notify_all();
+  } else {
+    pool->idle_cv.notify_one();
+  }
+}
+
+static void scan_add(ScanPool *pool, ScanWorker *w, const ScanJob &job,
+                     std::string_view name, ScanKind kind, u64 size,
+                     u32 mtime) {
+  ScanEntry entry;
+  entry.size = size;
+  entry.mtime = mtime;
+  entry.name = (u32)w->out.names.size();
+  entry.name_len = (u16)name.size();
+  entry.parent = job.id;
+  entry.kind = kind;
+  w->out.names.append(name);
+
+  if (kind == ScanKind::Dir && pool->opts.recursive) {
+    entry.id = pool->next_id++;
+    w->dirs.push_back({entry.id, (u32)w->out.entries.size()});
+
+    std::string path = job.path;
+    path += '/';
+    path += name;
+
+    pool->pending++;
+    {
+      std::lock_guard lock(w->mtx);
+      w->jobs.push_back({std::move(path), entry.id});
+    }
+    pool->queued++;
+    scan_wake(pool, false);
+  } else if (kind == ScanKind::File && pool->opts.found) {
+    (*pool->opts.found)++;
+  }
+
+  w->out.entries.push_back(entry);
+}
+
+#ifdef _WIN32
+// FindFirstFileEx returns sizes and times with the names, no extra calls
+static bool scan_dir(ScanPool *pool, ScanWorker *w, const ScanJob &job) {
+  std::wstring pattern = fs::path(job.path).wstring() + L"\\*";
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileExW(pattern.data(), FindExInfoBasic, &data,
+                                 FindExSearchNameMatch, nullptr,
+                                 FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  defer(FindClose(find));
+
+  char name[MAX_PATH * 4];
+  do {
+    if (wcscmp(data.cFileName, L".") == 0 ||
+        wcscmp(data.cFileName, L"..") == 0) {
+      continue;
+    }
+
+    i32 len = WideCharToMultiByte(CP_ACP, 0, data.cFileName, -1, name,
+                                  sizeof(name), nullptr, nullptr);
+    if (len <= 1) {
+      continue;
+    }
+
+    ScanKind kind = ScanKind::File;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+      kind = ScanKind::Other;
+    } else if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      kind = ScanKind::Dir;
+    }
+
+    u64 size = ((u64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    u64 time = ((u64)data.ftLastWriteTime.dwHighDateTime << 32) |
+               data.ftLastWriteTime.dwLowDateTime;
+
+    // 100ns intervals since 1601
+    constexpr u64 unix_epoch = 116444736000000000;
+    u32 mtime = time > unix_epoch ? (u32)((time - unix_epoch) / 10000000) : 0;
+
+    scan_add(pool, w, job, std::string_view(name, len - 1), kind,
+             kind == ScanKind::File ? size : 0, mtime);
+  } while (FindNextFileW(find, &data));
+
+  return true;
+}
+#else
+struct LinuxDirent64 {
+  u64 d_ino;
+  i64 d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// getdents64 reads many entries per call and gives their types. only
+// regular files are statted, with statx asking for just size and mtime
+static bool scan_dir(ScanPool *pool, ScanWorker *w, const ScanJob &job) {
+  i32 fd = open(job.path.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  defer(close(fd));
+
+  while (true) {
+    i64 n = syscall(SYS_getdents64, fd, w->buf.data(), w->buf.size());
+    if (n <= 0) {
+      return n == 0;
+    }
+
+    for (i64 pos = 0; pos < n;) {
+      auto d = (LinuxDirent64 *)(w->buf.data() + pos);
+      pos += d->d_reclen;
+
+      const char *name = d->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+
+      ScanKind kind = ScanKind::Other;
+      u32 mask = STATX_SIZE | STATX_MTIME;
+      switch (d->d_type) {
+      case DT_DIR: kind = ScanKind::Dir; break;
+      case DT_REG: kind = ScanKind::File; break;
+      case DT_UNKNOWN: mask |= STATX_TYPE; break;
+      default: break;
+      }
+
+      u64 size = 0;
+      u32 mtime = 0;
+      if (kind == ScanKind::File || d->d_type == DT_UNKNOWN) {
+        struct statx stx;
+        i32 flags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+        if (statx(fd, name, flags, mask, &stx)) {
+          continue;
+        }
+
+        if (d->d_type == DT_UNKNOWN) {
+          if (S_ISDIR(stx.stx_mode)) {
+            kind = ScanKind::Dir;
+          } else if (S_ISREG(stx.stx_mode)) {
+            kind = ScanKind::File;
+          }
+        }
+
+        if (kind == ScanKind::File) {
+          size = stx.stx_size;
+          mtime = (u32)stx.stx_mtime.tv_sec;
+        }
+      }
+
+      scan_add(pool, w, job, name, kind, size, mtime);
+    }
+  }
+}
+#endif
+
+static bool scan_take(ScanPool *pool, u32 self, ScanJob *job) {
+  ScanWorker *w = pool->workers[self].get();
+  {
+    std::lock_guard lock(w->mtx);
+    if (!w->jobs.empty()) {
+      *job = std::move(w->jobs.back());
+      w->jobs.pop_back();
+      return true;
+    }
+  }
+
+  u32 count = (u32)pool->workers.size();
+  for (u32 i = 1; i < count; i++) {
+    ScanWorker *victim = pool->workers[(self + i) % count].get();
+    std::lock_guard lock(victim->mtx);
+    if (!victim->jobs.empty()) {
+      *job = std::move(victim->jobs.front());
+      victim->jobs.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void scan_worker(ScanPool *pool, u32 self) {
+  ScanWorker *w = pool->workers[self].get();
+  w->buf.resize(64 * 1024);
+
+  while (pool->pending > 0) {
+    if (pool->opts.quit && *pool->opts.quit) {
+      return;
+    }
+
+    ScanJob job;
+    u64 queued = pool->queued;
+    if (!scan_take(pool, self, &job)) {
+      // someone is still reading a directory that may add more. the
+      // timeout is only there to notice quit
+      std::unique_lock lock(pool->idle_mtx);
+      pool->parked++;
+      pool->idle_cv.wait_for(lock, std::chrono::milliseconds(10), [&] {
+        return pool->queued != queued || pool->pending == 0;
+      });
+      pool->parked--;
+      continue;
+    }
+
+    scan_dir(pool, w, job);
+    if (--pool->pending == 0) {
+      scan_wake(pool, true);
+    }
+  }
+}
+
+bool scan_tree(const std::string &root, ScanTree *tree,
+               const ScanOptions &opts) {
+  *tree = {};
+
+  ScanPool pool;
+  pool.opts = opts;
+  u32 threads = std::max(opts.recursive ? opts.threads : 1, 1u);
+  for (u32 i = 0; i < threads; i++) {
+    pool.workers.push_back(std::make_unique<ScanWorker>());
+  }
+
+  // the root is read up front so a missing root is an error, not an
+  // empty tree
+  ScanWorker *first = pool.workers[0].get();
+  first->buf.resize(64 * 1024);
+  if (!scan_dir(&pool, first, {root, 0})) {
+    return false;
+  }
+
+  std::vector<std::thread> helpers;
+  for (u32 i = 1; i < threads; i++) {
+    helpers.emplace_back(scan_worker, &pool, i);
+  }
+  scan_worker(&pool, 0);
+  for (auto &thread : helpers) {
+    thread.join();
+  }
+
+  u64 entries = 0;
+  u64 names = 0;
+  for (auto &w : pool.workers) {
+    entries += w->out.entries.size();
+    names += w->out.names.size();
+  }
+
+  tree->entries.reserve(entries);
+  tree->names.reserve(names);
+  tree->dirs.resize(pool.next_id);
+  for (auto &w : pool.workers) {
+    u32 base = (u32)tree->entries.size();
+    u32 name_base = (u32)tree->names.size();
+    for (auto entry : w->out.entries) {
+      entry.name += name_base;
+      tree->entries.push_back(entry);
+    }
+    tree->names.append(w->out.names);
+
+    for (auto [id, index] : w->dirs) {
+      tree->dirs[id] = base + index;
+    }
+  }
+
+  return true;
+}
+
+std::string_view scan_name(const ScanTree &tree, const ScanEntry &entry) {
+  return std::string_view(tree.names.data() + entry.name, entry.name_len);
+}
+
+std::string scan_path(const ScanTree &tree, const ScanEntry &entry) {
+  std::vector<const ScanEntry *> chain;
+  for (const ScanEntry *e = &entry;;) {
+    chain.push_back(e);
+    if (e->parent == 0) {
+      break;
+    }
+    e = &tree.entries[tree.dirs[e->parent]];
+  }
+
+  std::string path;
+  for (u64 i = chain.size(); i-- > 0;) {
+    if (!path.empty()) {
+      path += '/';
+    }
+    path.append(scan_name(tree, *chain[i]));
+  }
+  return path;
+}
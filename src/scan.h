@@ -0,0 +1,49 @@
+#pragma once
+
+#include "language.h"
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class ScanKind : u8 {
+  File,
+  Dir,
+  Other,
+};
+
+// one directory entry. names live in the tree's name buffer, so a scan
+// allocates per directory, not per entry
+struct ScanEntry {
+  u64 size = 0;
+  u32 mtime = 0;  // unix seconds
+  u32 name = 0;   // offset into ScanTree::names
+  u32 parent = 0; // directory id, 0 is the root
+  u32 id = 0;     // directory id of a Dir entry
+  u16 name_len = 0;
+  ScanKind kind = ScanKind::Other;
+};
+
+struct ScanTree {
+  std::vector<ScanEntry> entries;
+  std::vector<u32> dirs; // directory id -> entry index, unused for the root
+  std::string names;
+};
+
+struct ScanOptions {
+  bool recursive = true;
+  u32 threads = 1;
+  const std::atomic<bool> *quit = nullptr;
+  std::atomic<i32> *found = nullptr; // files seen so far, for progress
+};
+
+// lists root, or the whole tree below it, with a work-stealing pool of
+// threads. entries come in no particular order. returns false if root
+// can't be read; unreadable directories below it are skipped
+bool scan_tree(const std::string &root, ScanTree *tree,
+               const ScanOptions &opts);
+
+std::string_view scan_name(const ScanTree &tree, const ScanEntry &entry);
+
+// path of the entry relative to the root, with / separators
+std::string scan_path(const ScanTree &tree, const ScanEntry &entry);
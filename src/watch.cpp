@@ -0,0 +1,346 @@
+#include "watch.h"
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// the notification buffer starts small and doubles while reads fill more
+// than half of it
+constexpr u32 WATCH_MIN_BUF = 16 * 1024;
+constexpr u32 WATCH_MAX_BUF = 1024 * 1024;
+
+#ifdef _WIN32
+static FileAction file_action(DWORD action) {
+  switch (action) {
+  case FILE_ACTION_ADDED: return FileAction::Added;
+  case FILE_ACTION_REMOVED: return FileAction::Removed;
+  case FILE_ACTION_RENAMED_OLD_NAME: return FileAction::RenamedOld;
+  case FILE_ACTION_RENAMED_NEW_NAME: return FileAction::RenamedNew;
+  default: return FileAction::Modified;
+  }
+}
+
+bool watcher_init(FileWatcher *watcher, const std::filesystem::path &path,
+                  const wchar_t **error) {
+  HANDLE dir =
+      CreateFile(path.c_str(), FILE_LIST_DIRECTORY,
+                 FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                 nullptr, OPEN_EXISTING,
+                 FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+  if (dir == INVALID_HANDLE_VALUE) {
+    *error = L"cannot create directory handle for file watcher";
+    return false;
+  }
+
+  OVERLAPPED overlapped = {};
+  overlapped.hEvent = CreateEvent(nullptr, false, false, nullptr);
+  watcher->wake = CreateEvent(nullptr, false, false, nullptr);
+
+  DWORD buf_size = WATCH_MIN_BUF;
+  void *buf = malloc(buf_size);
+
+  bool ok = ReadDirectoryChangesW(dir, buf, buf_size, true,
+                                  FILE_NOTIFY_CHANGE_FILE_NAME |
+                                      FILE_NOTIFY_CHANGE_DIR_NAME |
+                                      FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                  nullptr, &overlapped, nullptr);
+  if (!ok) {
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(watcher->wake);
+    CloseHandle(dir);
+    free(buf);
+    watcher->wake = nullptr;
+    *error = L"ReadDirectoryChangesW failed";
+    return false;
+  }
+
+  watcher->dir = dir;
+  watcher->synced_at = fs::file_time_type::clock::now();
+  watcher->overlapped = overlapped;
+  watcher->buf = buf;
+  watcher->buf_size = buf_size;
+  return true;
+}
+
+bool watcher_destroy(FileWatcher *watcher) {
+  if (!CloseHandle(watcher->overlapped.hEvent)) {
+    return false;
+  }
+
+  if (!CloseHandle(watcher->wake)) {
+    return false;
+  }
+
+  if (!CloseHandle(watcher->dir)) {
+    return false;
+  }
+
+  free(watcher->buf);
+
+  *watcher = {};
+  return true;
+}
+
+void watcher_poll(FileWatcher *watcher) {
+  watcher->changes.clear();
+  watcher->overflowed = false;
+  if (!watcher->running()) {
+    return;
+  }
+
+  if (!watcher->overlapped.hEvent) {
+    return;
+  }
+
+  auto polled_at = fs::file_time_type::clock::now();
+
+  // the event may already have been consumed by watcher_wait, so ask the
+  // overlapped result directly
+  DWORD bytes = 0;
+  if (!GetOverlappedResult(watcher->dir, &watcher->overlapped, &bytes,
+                           false)) {
+    if (GetLastError() != ERROR_NOTIFY_ENUM_DIR) {
+      return;
+    }
+    bytes = 0;
+  }
+
+  // zero bytes means the changes didn't fit in the buffer and were dropped
+  watcher->overflowed = bytes == 0;
+  if (!watcher->overflowed) {
+    watcher->synced_at = polled_at;
+  }
+
+  auto info = (FILE_NOTIFY_INFORMATION *)watcher->buf;
+
+  char filename[MAX_PATH] = {};
+
+  while (bytes != 0) {
+    if (info->Action != 0) {
+      i32 wlen = info->FileNameLength / sizeof(wchar_t);
+
+      errno_t err = wcstombs_s(nullptr, filename, array_size(filename),
+                               info->FileName, wlen);
+      if (!err) {
+        FileChange change = {};
+        change.type = file_action(info->Action);
+        change.filename = filename;
+        watcher->changes.push_back(std::move(change));
+      }
+    }
+
+    if (info->NextEntryOffset) {
+      char *next_entry = &((char *)info)[info->NextEntryOffset];
+      info = (FILE_NOTIFY_INFORMATION *)next_entry;
+    } else {
+      break;
+    }
+  }
+
+  if ((watcher->overflowed || bytes > watcher->buf_size / 2) &&
+      watcher->buf_size < WATCH_MAX_BUF) {
+    free(watcher->buf);
+    watcher->buf_size *= 2;
+    watcher->buf = malloc(watcher->buf_size);
+  }
+
+  ReadDirectoryChangesW(watcher->dir, watcher->buf, watcher->buf_size, true,
+                        FILE_NOTIFY_CHANGE_FILE_NAME |
+                            FILE_NOTIFY_CHANGE_DIR_NAME |
+                            FILE_NOTIFY_CHANGE_LAST_WRITE,
+                        nullptr, &watcher->overlapped, nullptr);
+}
+
+void watcher_wait(FileWatcher *watcher, i32 timeout_ms) {
+  HANDLE handles[] = {watcher->overlapped.hEvent, watcher->wake};
+  WaitForMultipleObjects(array_size(handles), handles, false,
+                         timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+}
+
+void watcher_wake(FileWatcher *watcher) { SetEvent(watcher->wake); }
+#else
+constexpr u32 WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                           IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR |
+                           IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+static std::string watcher_join(const std::string &dir,
+                                const std::string &name) {
+  return dir.empty() ? name : dir + "/" + name;
+}
+
+// watches dir and every directory below it. the watch on a directory is
+// added before its entries are listed, so a file is either seen by the
+// listing or reported by inotify. when report is set, files found by the
+// listing are reported as modified, they could have been written before
+// the watch existed
+static void watcher_add_tree(FileWatcher *watcher, const std::string &dir,
+                             bool report) {
+  std::string path = watcher_join(watcher->root, dir);
+  i32 wd = inotify_add_watch(watcher->fd, path.data(), WATCH_MASK);
+  if (wd < 0) {
+    return;
+  }
+  watcher->dirs[wd] = dir;
+
+  std::error_code ec;
+  for (auto &entry : fs::directory_iterator(path, ec)) {
+    std::string name = watcher_join(dir, entry.path().filename().string());
+    if (entry.is_directory(ec) && !entry.is_symlink(ec)) {
+      watcher_add_tree(watcher, name, report);
+    } else if (report && entry.is_regular_file(ec)) {
+      watcher->changes.push_back({name, FileAction::Modified});
+    }
+  }
+}
+
+// a directory moved out of the tree keeps its watches, which would report
+// changes under the old name
+static void watcher_remove_tree(FileWatcher *watcher, const std::string &dir) {
+  std::string prefix = dir + "/";
+  for (auto it = watcher->dirs.begin(); it != watcher->dirs.end();) {
+    if (it->second == dir || it->second.starts_with(prefix)) {
+      inotify_rm_watch(watcher->fd, it->first);
+      it = watcher->dirs.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+bool watcher_init(FileWatcher *watcher, const std::filesystem::path &path,
+                  const wchar_t **error) {
+  i32 fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    *error = L"cannot create inotify instance for file watcher";
+    return false;
+  }
+
+  watcher->fd = fd;
+  watcher->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  watcher->root = path.string();
+  watcher->synced_at = fs::file_time_type::clock::now();
+
+  // events are read in batches, a large buffer takes many per syscall
+  watcher->buf.resize(WATCH_MIN_BUF);
+
+  watcher_add_tree(watcher, "", false);
+  if (watcher->dirs.empty()) {
+    watcher_destroy(watcher);
+    *error = L"cannot watch directory";
+    return false;
+  }
+  return true;
+}
+
+bool watcher_destroy(FileWatcher *watcher) {
+  if (close(watcher->fd)) {
+    return false;
+  }
+
+  if (close(watcher->wake_fd)) {
+    return false;
+  }
+
+  *watcher = {};
+  return true;
+}
+
+void watcher_poll(FileWatcher *watcher) {
+  watcher->changes.clear();
+  watcher->overflowed = false;
+  if (!watcher->running()) {
+    return;
+  }
+
+  auto polled_at = fs::file_time_type::clock::now();
+
+  while (true) {
+    i64 n = read(watcher->fd, watcher->buf.data(), watcher->buf.size());
+    if (n <= 0) {
+      break;
+    }
+
+    if ((u64)n > watcher->buf.size() / 2 &&
+        watcher->buf.size() < WATCH_MAX_BUF) {
+      watcher->buf.resize(watcher->buf.size() * 2);
+    }
+
+    for (i64 pos = 0; pos < n;) {
+      auto event = (inotify_event *)&watcher->buf[pos];
+      pos += sizeof(inotify_event) + event->len;
+
+      // the kernel queue filled up and events were dropped
+      if (event->mask & IN_Q_OVERFLOW) {
+        watcher->overflowed = true;
+        continue;
+      }
+
+      if (event->mask & IN_IGNORED) {
+        watcher->dirs.erase(event->wd);
+        continue;
+      }
+
+      auto dir = watcher->dirs.find(event->wd);
+      if (dir == watcher->dirs.end() || event->len == 0) {
+        continue;
+      }
+
+      std::string name = watcher_join(dir->second, event->name);
+      bool is_dir = event->mask & IN_ISDIR;
+
+      if (event->mask & IN_CLOSE_WRITE) {
+        watcher->changes.push_back({name, FileAction::Modified});
+      } else if (event->mask & IN_CREATE) {
+        watcher->changes.push_back({name, FileAction::Added});
+        if (is_dir) {
+          watcher_add_tree(watcher, name, true);
+        }
+      } else if (event->mask & IN_DELETE) {
+        watcher->changes.push_back({name, FileAction::Removed});
+      } else if (event->mask & IN_MOVED_FROM) {
+        watcher->changes.push_back({name, FileAction::RenamedOld});
+        if (is_dir) {
+          watcher_remove_tree(watcher, name);
+        }
+      } else if (event->mask & IN_MOVED_TO) {
+        watcher->changes.push_back({name, FileAction::RenamedNew});
+        if (is_dir) {
+          watcher_add_tree(watcher, name, true);
+        }
+      }
+    }
+  }
+
+  if (watcher->overflowed) {
+    // directories made while events were dropped have no watch yet. adding
+    // a watch that exists only refreshes its path
+    watcher_add_tree(watcher, "", false);
+  } else {
+    watcher->synced_at = polled_at;
+  }
+}
+
+void watcher_wait(FileWatcher *watcher, i32 timeout_ms) {
+  pollfd fds[2] = {};
+  fds[0].fd = watcher->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = watcher->wake_fd;
+  fds[1].events = POLLIN;
+  poll(fds, array_size(fds), timeout_ms);
+
+  u64 count = 0;
+  while (read(watcher->wake_fd, &count, sizeof(count)) > 0) {
+  }
+}
+
+void watcher_wake(FileWatcher *watcher) {
+  u64 one = 1;
+  write(watcher->wake_fd, &one, sizeof(one));
+}
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "language.h"
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+enum class FileAction : i32 {
+  Added,
+  Removed,
+  Modified,
+  RenamedOld,
+  RenamedNew,
+};
+
+struct FileChange {
+  std::string filename; // relative to the watched dir
+  FileAction type = FileAction::Modified;
+  f64 at = 0; // when the change was read from the os
+};
+
+#ifdef _WIN32
+struct FileWatcher {
+  OVERLAPPED overlapped = {};
+  HANDLE dir = INVALID_HANDLE_VALUE;
+  void *buf = nullptr;
+  DWORD buf_size = 0;
+  HANDLE wake = nullptr; // interrupts watcher_wait
+  std::vector<FileChange> changes;
+  bool overflowed = false; // changes were dropped, the tree has to be scanned
+  // no changes were dropped before this
+  std::filesystem::file_time_type synced_at;
+  std::unordered_map<std::string, i64> modtimes;
+
+  bool running() const { return dir != INVALID_HANDLE_VALUE; }
+};
+#else
+// inotify watches a single directory, so every directory in the tree gets
+// its own watch
+struct FileWatcher {
+  i32 fd = -1;
+  std::string root;
+  std::unordered_map<i32, std::string> dirs; // watch -> dir relative to root
+  std::vector<char> buf;
+  i32 wake_fd = -1; // eventfd that interrupts watcher_wait
+  std::vector<FileChange> changes;
+  bool overflowed = false; // changes were dropped, the tree has to be scanned
+  // no changes were dropped before this
+  std::filesystem::file_time_type synced_at;
+  std::unordered_map<std::string, i64> modtimes;
+
+  bool running() const { return fd != -1; }
+};
+#endif
+
+// returns false and sets error if the directory can't be watched
+bool watcher_init(FileWatcher *watcher, const std::filesystem::path &path,
+                  const wchar_t **error);
+bool watcher_destroy(FileWatcher *watcher);
+
+// reads the changes the os has queued into watcher->changes
+void watcher_poll(FileWatcher *watcher);
+
+// blocks until the os has changes, watcher_wake is called or the timeout
+// passes. a negative timeout waits forever
+void watcher_wait(FileWatcher *watcher, i32 timeout_ms);
+void watcher_wake(FileWatcher *watcher);
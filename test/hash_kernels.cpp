@@ -0,0 +1,145 @@
+// checks the avx2, sse2 and scalar hash64 kernels give the same hashes,
+// that a hash doesn't depend on how the input is split across updates, and
+// that hash_tree_file doesn't depend on how many threads hash the leaves.
+// kernels this cpu can't run are skipped. exits non-zero on a mismatch
+
+#include "hash.h"
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+// spans many blocks of stripes, and the lengths below cover every tail
+constexpr u64 TEST_BYTES = 64 * 1024 + 77;
+constexpr u64 TEST_TREE_BYTES = 5 * HASH_TREE_LEAF + 123;
+
+static u64 xorshift(u64 *state) {
+  u64 x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static std::vector<u8> random_bytes(u64 size) {
+  std::vector<u8> data(size);
+  u64 state = 0x9e3779b97f4a7c15;
+  for (u8 &byte : data) {
+    byte = (u8)xorshift(&state);
+  }
+  return data;
+}
+
+// every length up to a few blocks, then a few longer ones
+static std::vector<u64> test_lengths() {
+  std::vector<u64> lengths;
+  for (u64 len = 0; len <= 3000; len++) {
+    lengths.push_back(len);
+  }
+  for (u64 len = 3001; len <= TEST_BYTES; len = len * 3 / 2) {
+    lengths.push_back(len);
+  }
+  lengths.push_back(TEST_BYTES);
+  return lengths;
+}
+
+// feeds the input in pieces of random size, some under a stripe and some
+// over a block
+static u64 hash_split(const std::vector<u8> &data, u64 len, u64 *state) {
+  Hash64 h;
+  hash64_init(&h);
+  for (u64 pos = 0; pos < len;) {
+    u64 most = xorshift(state) % 2 ? 70 : 3000;
+    u64 piece = std::min(xorshift(state) % most, len - pos);
+    hash64_update(&h, data.data() + pos, piece);
+    pos += piece;
+  }
+  return hash64_final(&h);
+}
+
+static bool check_kernels(const std::vector<u8> &data) {
+  std::vector<u64> lengths = test_lengths();
+
+  // the scalar kernel runs everywhere, the others are compared with it
+  hash64_use_kernel("scalar");
+  std::vector<u64> expected;
+  for (u64 len : lengths) {
+    expected.push_back(hash64(data.data(), len));
+  }
+
+  bool ok = true;
+  for (const char *kernel : {"scalar", "sse2", "avx2"}) {
+    if (!hash64_use_kernel(kernel)) {
+      printf("%s: not supported on this cpu, skipped\n", kernel);
+      continue;
+    }
+
+    u64 state = 0x243f6a8885a308d3;
+    u64 mismatches = 0;
+    for (u64 i = 0; i < lengths.size(); i++) {
+      u64 len = lengths[i];
+      u64 whole = hash64(data.data(), len);
+      u64 split = hash_split(data, len, &state);
+      if (whole != expected[i] || split != expected[i]) {
+        if (mismatches++ == 0) {
+          fprintf(stderr,
+                  "%s: %llu bytes hash to %016llx whole and %016llx split, "
+                  "scalar gives %016llx\n",
+                  kernel, (unsigned long long)len, (unsigned long long)whole,
+                  (unsigned long long)split,
+                  (unsigned long long)expected[i]);
+        }
+      }
+    }
+    printf("%s: %llu lengths, %llu mismatches\n", kernel,
+           (unsigned long long)lengths.size(),
+           (unsigned long long)mismatches);
+    ok &= mismatches == 0;
+  }
+  return ok;
+}
+
+static bool check_tree(const std::vector<u8> &data) {
+  fs::path path = fs::temp_directory_path() / "hash_kernels.bin";
+  FILE *fp = fopen(path.string().data(), "wb");
+  if (!fp || fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+    fprintf(stderr, "cannot write %s\n", path.string().data());
+    return false;
+  }
+  fclose(fp);
+  std::error_code ec;
+  defer(fs::remove(path, ec));
+
+  u8 expected[32] = {};
+  bool ok = true;
+  for (u32 threads : {1, 2, 4, 8}) {
+    HashPool pool;
+    hash_pool_start(&pool, threads);
+    defer(hash_pool_stop(&pool));
+
+    // twice, the second file reuses the workers
+    for (i32 run = 0; run < 2; run++) {
+      u8 out[32] = {};
+      if (!hash_tree_file(&pool, path.string().data(), out)) {
+        fprintf(stderr, "cannot hash %s\n", path.string().data());
+        return false;
+      }
+      if (threads == 1 && run == 0) {
+        memcpy(expected, out, sizeof(out));
+      } else if (memcmp(expected, out, sizeof(out)) != 0) {
+        fprintf(stderr, "hash_tree_file differs on %u threads\n", threads);
+        ok = false;
+      }
+    }
+  }
+  printf("hash_tree_file: %s on 1 to 8 threads\n", ok ? "same" : "differs");
+  return ok;
+}
+
+int main() {
+  bool ok = check_kernels(random_bytes(TEST_BYTES));
+  ok &= check_tree(random_bytes(TEST_TREE_BYTES));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// writes 100k files under a watched tree, some into directories made after
+// the watch started, then rewrites them all. checks every write is
+// reported. if the os dropped events, the tree is walked the way the app
+// rescans it and that walk has to find what was missed. exits non-zero
+// otherwise
+
+#include "watch.h"
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+constexpr i32 STRESS_DIRS = 100;     // made before the watch starts
+constexpr i32 STRESS_NEW_DIRS = 20;  // made by the writer
+constexpr i32 STRESS_FILES = 100000;
+
+static f64 seconds_since(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<f64>(elapsed).count();
+}
+
+// new directories are nested, so the watcher has to add a tree it may only
+// see the top of
+static std::string file_name(i32 i) {
+  i32 dir = i % (STRESS_DIRS + STRESS_NEW_DIRS);
+  if (dir < STRESS_DIRS) {
+    return "d" + std::to_string(dir) + "/f" + std::to_string(i);
+  }
+  return "n" + std::to_string(dir - STRESS_DIRS) + "/s/f" + std::to_string(i);
+}
+
+static void write_files(const fs::path &root, const char *contents) {
+  std::error_code ec;
+  for (i32 i = 0; i < STRESS_FILES; i++) {
+    fs::path path = root / file_name(i);
+    fs::create_directories(path.parent_path(), ec);
+    FILE *fp = fopen(path.string().data(), "wb");
+    if (fp) {
+      fputs(contents, fp);
+      fclose(fp);
+    }
+  }
+}
+
+// what the app does on overflow: every file written since the watcher was
+// last in sync may have been missed
+static void rescan(FileWatcher *watcher, const fs::path &root,
+                   std::unordered_set<std::string> *seen) {
+  // some file systems store write times with a resolution of 2 seconds
+  auto since = watcher->synced_at - std::chrono::seconds(2);
+  std::error_code ec;
+  for (auto &entry : fs::recursive_directory_iterator(root, ec)) {
+    if (entry.is_regular_file(ec) && entry.last_write_time(ec) >= since) {
+      seen->insert(fs::relative(entry.path(), root, ec).generic_string());
+    }
+  }
+}
+
+// runs one writer over the tree and returns false if a write was neither
+// reported nor found by a rescan
+static bool stress_pass(FileWatcher *watcher, const fs::path &root,
+                        const char *what, const char *contents) {
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<bool> written = false;
+  std::thread writer([&] {
+    write_files(root, contents);
+    written = true;
+    watcher_wake(watcher);
+  });
+
+  // the writer is done once it says so, the last events may still be queued
+  std::unordered_set<std::string> seen;
+  i32 overflows = 0;
+  i32 idle = 0;
+  while (seen.size() < STRESS_FILES && idle < 3) {
+    watcher_wait(watcher, 1000);
+    watcher_poll(watcher);
+    if (watcher->overflowed) {
+      overflows++;
+      rescan(watcher, root, &seen);
+    }
+    for (auto &change : watcher->changes) {
+      if (change.type == FileAction::Modified) {
+        seen.insert(change.filename);
+      }
+    }
+    idle = written && watcher->changes.empty() ? idle + 1 : 0;
+  }
+  writer.join();
+  f64 elapsed = seconds_since(start);
+
+  printf("%s: %zu of %d writes reported in %.2fs, %d rescans\n", what,
+         seen.size(), STRESS_FILES, elapsed, overflows);
+  for (i32 i = 0; i < STRESS_FILES; i++) {
+    if (!seen.contains(file_name(i))) {
+      fprintf(stderr, "%s: missed %s\n", what, file_name(i).data());
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  fs::path root = fs::temp_directory_path() / "watch_stress";
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  for (i32 i = 0; i < STRESS_DIRS; i++) {
+    fs::create_directories(root / ("d" + std::to_string(i)));
+  }
+  defer(fs::remove_all(root, ec));
+
+  FileWatcher watcher;
+  const wchar_t *error = nullptr;
+  if (!watcher_init(&watcher, root, &error)) {
+    fprintf(stderr, "%ls\n", error);
+    return 1;
+  }
+  defer(watcher_destroy(&watcher));
+
+  if (!stress_pass(&watcher, root, "create", "x")) {
+    return 1;
+  }
+  if (!stress_pass(&watcher, root, "rewrite", "xy")) {
+    return 1;
+  }
+  return 0;
+}